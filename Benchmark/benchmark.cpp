@@ -0,0 +1,74 @@
+//
+// benchmark.cpp
+// Timings of cql hash tables against the standard containers; build in Release.
+//
+
+#include "ContainerQueryLibrary.h"
+#include <chrono>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace
+{
+	std::vector<uint64_t> RandomKeys(size_t count, uint64_t range)
+	{
+		std::vector<uint64_t> keys(count);
+		uint64_t state = 88172645463325252ull;
+		for (auto& key : keys)
+		{
+			state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+			key = state % range;
+		}
+		return keys;
+	}
+
+	long long Milliseconds(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to)
+	{
+		return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+	}
+
+	template<typename TMap>
+	void InsertAndLookup(TMap map, const std::vector<uint64_t>& keys, const char* name)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (auto key : keys)
+			map[key]++;
+		auto inserted = std::chrono::steady_clock::now();
+		size_t found = 0;
+		for (auto key : keys)
+			found += map.count(key + 1);
+		auto looked = std::chrono::steady_clock::now();
+		std::cout << name << ": insert " << Milliseconds(start, inserted) << " ms, lookup "
+			<< Milliseconds(inserted, looked) << " ms (" << found << " hits)\n";
+	}
+
+	// Lookups in a table larger than the last-level cache, half of them misses.
+	template<typename TSet>
+	void LargeTableProbe(TSet set, const std::vector<uint64_t>& probes, const char* name)
+	{
+		set.reserve(probes.size());
+		for (auto probe : probes)
+			set.insert(probe ^ 1);
+		auto start = std::chrono::steady_clock::now();
+		size_t hits = 0;
+		for (auto probe : probes)
+			hits += set.count(probe);
+		auto probed = std::chrono::steady_clock::now();
+		std::cout << name << ": probe " << Milliseconds(start, probed) << " ms (" << hits << " hits)\n";
+	}
+}
+
+int main()
+{
+	const size_t count = 1 << 21;
+	auto keys = RandomKeys(count, count / 2);
+	InsertAndLookup(std::unordered_map<uint64_t, int>(), keys, "std::unordered_map");
+	InsertAndLookup(cql::FlatHashMap<uint64_t, int>(), keys, "cql::FlatHashMap");
+
+	const size_t probeCount = 1 << 23;
+	auto probes = RandomKeys(probeCount, probeCount * 2);
+	LargeTableProbe(std::unordered_set<uint64_t>(), probes, "std::unordered_set");
+	LargeTableProbe(cql::FlatHashSet<uint64_t>(), probes, "cql::FlatHashSet");
+	return 0;
+}
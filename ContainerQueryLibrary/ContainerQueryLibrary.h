@@ -6,11 +6,79 @@
 #include<list>
 #include<map>
 #include<algorithm>
+#include<functional>
+#include<iterator>
+#include<type_traits>
+
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+#include<string>
+#include<string_view>
+#include<memory>
+#include<optional>
+#include<mutex>
+#include<shared_mutex>
+#include<unordered_map>
+#include<utility>
+#include<tuple>
+#include<deque>
+#include<cstdint>
+#include<atomic>
+#include<chrono>
+#include<condition_variable>
+#include<exception>
+#include<thread>
+#include<variant>
+#include<any>
+#include<limits>
+#include<cstddef>
+#include<new>
+#include<fstream>
+#include<istream>
+#include<sstream>
+#include<charconv>
+#include<cstring>
+#include<stdexcept>
+#include<system_error>
+#include<cerrno>
+#include<cstdio>
+#if __has_include(<span>)
+#include<span>
+#endif
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include<windows.h>
+#else
+#include<fcntl.h>
+#include<sys/mman.h>
+#include<sys/socket.h>
+#include<sys/stat.h>
+#include<sys/wait.h>
+#include<unistd.h>
+#endif
+#endif
 
 #if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
 #include <experimental/generator>
 #endif
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include<coroutine>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CONTAINER_QUERY_LIBRARY_SSE2
+#include<emmintrin.h>
+#endif
+#if defined(_MSC_VER)
+#include<intrin.h>
+#endif
+
 namespace cql
 {
 	template <typename Type>
@@ -23,6 +91,247 @@ namespace cql
 	template <typename... A>
 	struct IsList<std::list<A...> > : public std::true_type {};
 
+	template <typename...>
+	struct MakeVoid { using type = void; };
+
+	template <typename Type, typename = void>
+	struct HasPushBack : public std::false_type {};
+	template <typename Type>
+	struct HasPushBack<Type, typename MakeVoid<decltype(std::declval<Type&>().push_back(*std::declval<Type&>().begin()))>::type> : public std::true_type {};
+
+	template <typename Type, typename = void>
+	struct HasMemberSort : public std::false_type {};
+	template <typename Type>
+	struct HasMemberSort<Type, typename MakeVoid<decltype(std::declval<Type&>().sort())>::type> : public std::true_type {};
+
+	template <typename Type, typename = void>
+	struct HasRangeErase : public std::false_type {};
+	template <typename Type>
+	struct HasRangeErase<Type, typename MakeVoid<decltype(std::declval<Type&>().erase(std::declval<Type&>().begin(), std::declval<Type&>().end()))>::type> : public std::true_type {};
+
+	// Ranges that know their size without being walked: C arrays and containers with size().
+	template <typename Type, typename = void>
+	struct HasSize : public std::is_array<Type> {};
+	template <typename Type>
+	struct HasSize<Type, typename MakeVoid<decltype(std::declval<const Type&>().size())>::type> : public std::true_type {};
+
+	template <typename Type>
+	struct IsRandomAccessRange : public std::is_base_of<std::random_access_iterator_tag,
+		typename std::iterator_traits<decltype(std::begin(std::declval<Type&>()))>::iterator_category> {};
+
+	// Ranges that store their elements in one block: C arrays and containers whose data()
+	// returns a pointer (std::vector, std::array, std::span...; not std::deque).
+	template <typename Type, typename = void>
+	struct IsContiguousRange : public std::is_array<Type> {};
+	template <typename Type>
+	struct IsContiguousRange<Type, typename MakeVoid<decltype(std::declval<Type&>().data())>::type> : public std::is_pointer<decltype(std::declval<Type&>().data())> {};
+
+	template <typename Type>
+	struct RangeValue
+	{
+		using type = typename std::decay<decltype(*std::begin(std::declval<const Type&>()))>::type;
+	};
+
+	// std::set/map/multiset/multimap and their unordered counterparts.
+	template <typename Type, typename = void>
+	struct IsAssociative : public std::false_type {};
+	template <typename Type>
+	struct IsAssociative<Type, typename MakeVoid<typename Type::key_type, decltype(std::declval<Type&>().erase(std::declval<Type&>().begin()))>::type> : public std::true_type {};
+
+	// Associative containers whose keys are the elements themselves (sets).
+	template <typename Type, typename = void>
+	struct IsSetLike : public std::false_type {};
+	template <typename Type>
+	struct IsSetLike<Type, typename std::enable_if<IsAssociative<Type>::value && std::is_same<typename Type::key_type, typename Type::value_type>::value>::type> : public std::true_type {};
+
+	// Associative containers that hold each key at most once (insert returns pair<iterator, bool>).
+	template <typename Type, typename = void>
+	struct HasUniqueKeys : public std::false_type {};
+	template <typename Type>
+	struct HasUniqueKeys<Type, typename std::enable_if<IsAssociative<Type>::value &&
+		!std::is_same<decltype(std::declval<Type&>().insert(std::declval<const typename Type::value_type&>())), typename Type::iterator>::value>::type> : public std::true_type {};
+
+	/* QueryResult:
+	*  The container type returned by queries that copy elements out of a range: the range's
+	*  own type when it is default constructible and supports push_back or is associative,
+	*  otherwise a std::vector of its elements (std::array, std::span, C arrays, mapped/shared tables).
+	*/
+	template <typename Type>
+	struct QueryResult
+	{
+		using type = typename std::conditional<(HasPushBack<Type>::value || IsAssociative<Type>::value) && std::is_default_constructible<Type>::value,
+			Type, 
+			std::vector<typename RangeValue<Type>::type>>::type;
+	};
+
+	namespace detail
+	{
+		// Adds an element to a QueryResult: push_back for sequences, insert at the end
+		// hint for associative containers, which is O(1) when elements arrive in order.
+		template <typename TContainer, typename TElement>
+		void Append(TContainer& container, TElement&& element, std::true_type)
+		{
+			container.push_back(std::forward<TElement>(element));
+		}
+
+		template <typename TContainer, typename TElement>
+		void Append(TContainer& container, TElement&& element, std::false_type)
+		{
+			container.insert(container.end(), std::forward<TElement>(element));
+		}
+
+		template <typename TContainer, typename TElement>
+		void Append(TContainer& container, TElement&& element)
+		{
+			Append(container, std::forward<TElement>(element), HasPushBack<TContainer>());
+		}
+
+		template <typename TContainer, typename TRange>
+		void AppendRange(TContainer& container, const TRange& range, std::true_type)
+		{
+			container.insert(std::begin(range), std::end(range));
+		}
+
+		template <typename TContainer, typename TRange>
+		void AppendRange(TContainer& container, const TRange& range, std::false_type)
+		{
+			container.insert(container.end(), std::begin(range), std::end(range));
+		}
+
+		template <typename TContainer, typename TRange>
+		void AppendRange(TContainer& container, const TRange& range)
+		{
+			AppendRange(container, range, IsAssociative<TContainer>());
+		}
+	}
+
+	namespace detail
+	{
+		// Step is called once per processed element by the query implementations and
+		// BeginPhase when they start a new pass over a range. The plain queries use this
+		// no-op one, cancellable/monitored queries one that polls a token or reports progress.
+		struct NoCheckpoint
+		{
+			void Step() {}
+			template<typename TRange>
+			void BeginPhase(const char*, const TRange&) {}
+		};
+	}
+
+	/* GroupingKeyTraits:
+	*  Maps the type returned by a grouping/joining function to the key type stored
+	*  in result maps and the comparator used for it.
+	*/
+	template <typename TKey>
+	struct GroupingKeyTraits
+	{
+		using StorageType = TKey;
+		using Compare = std::less<TKey>;
+	};
+
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+	/* HashedKey:
+	*  A key bundled with its precomputed hash. Returning it from a key function
+	*  makes hash tables reuse the cached hash and makes ordered maps compare the
+	*  hashes first, so most comparisons never touch the key itself.
+	*  Ordering is by (hash, key), not by key alone.
+	*
+	*  Usage:
+	*  auto res = GroupBy(logs, [](const Log& log) { return HashedKey<std::string_view>(log.url); });
+	*/
+	template <typename TKey>
+	struct HashedKey
+	{
+		HashedKey() = default;
+		explicit HashedKey(TKey key) : hash(std::hash<TKey>{}(key)), value(std::move(key)) {}
+		template <typename TOther>
+		explicit HashedKey(const HashedKey<TOther>& other) : hash(other.hash), value(other.value) {}
+
+		size_t hash = 0;
+		TKey value{};
+	};
+
+	template <typename TKey1, typename TKey2>
+	bool operator==(const HashedKey<TKey1>& l, const HashedKey<TKey2>& r) { return l.hash == r.hash && l.value == r.value; }
+	template <typename TKey1, typename TKey2>
+	bool operator!=(const HashedKey<TKey1>& l, const HashedKey<TKey2>& r) { return !(l == r); }
+	template <typename TKey1, typename TKey2>
+	bool operator<(const HashedKey<TKey1>& l, const HashedKey<TKey2>& r)
+	{
+		if (l.hash != r.hash)
+			return l.hash < r.hash;
+		return l.value < r.value;
+	}
+
+	/* StringKeyHash:
+	*  Transparent hash for string keys, std::string, std::string_view and
+	*  const char* hash to the same value, so lookups need no temporary strings.
+	*  FlatHashMap and FlatHashSet use it by default for string keys.
+	*/
+	struct StringKeyHash
+	{
+		using is_transparent = void;
+		size_t operator()(std::string_view key) const { return std::hash<std::string_view>{}(key); }
+	};
+
+	namespace detail
+	{
+		// The hasher and key comparison FlatHashMap and FlatHashSet use by default.
+		template<typename TKey>
+		struct DefaultHashing
+		{
+			using Hash = std::hash<TKey>;
+			using Equal = std::equal_to<TKey>;
+		};
+
+		template<>
+		struct DefaultHashing<std::string>
+		{
+			using Hash = StringKeyHash;
+			using Equal = std::equal_to<>;
+		};
+
+		template<>
+		struct DefaultHashing<std::string_view>
+		{
+			using Hash = StringKeyHash;
+			using Equal = std::equal_to<>;
+		};
+
+		// Reuses the cached hash, so HashedKey<std::string> tables are probed with
+		// HashedKey<std::string_view> without building a string.
+		struct HashedKeyHash
+		{
+			using is_transparent = void;
+			template<typename TKey>
+			size_t operator()(const HashedKey<TKey>& key) const { return key.hash; }
+		};
+
+		template<typename TKey>
+		struct DefaultHashing<HashedKey<TKey>>
+		{
+			using Hash = HashedKeyHash;
+			using Equal = std::equal_to<>;
+		};
+	}
+
+	// std::string_view keys are stored as std::string and looked up heterogeneously,
+	// so a string is only copied when a new key is inserted.
+	template <>
+	struct GroupingKeyTraits<std::string_view>
+	{
+		using StorageType = std::string;
+		using Compare = std::less<>;
+	};
+
+	template <>
+	struct GroupingKeyTraits<HashedKey<std::string_view>>
+	{
+		using StorageType = HashedKey<std::string>;
+		using Compare = std::less<>;
+	};
+#endif
+
 	/* Select Query:
 	*  For a given container it returns a list of whatever the selector returns
 	*  from each element of the container.
@@ -40,7 +349,7 @@ namespace cql
 	template<typename TContainer, typename TFunc>
 	auto Select(const TContainer& container, const TFunc& selector)
 	{
-		using type = decltype(selector(*container.begin()));
+		using type = decltype(selector(*std::begin(container)));
 		std::list<type> result;
 		for (auto& element : container)
 		{
@@ -50,9 +359,11 @@ namespace cql
 	}
 
 	/* Where Statement:
-	*  It filters any container with push_back modifier based on a predicate. 
+	*  It filters any range based on a predicate. 
 	* 
-	*  Returns: A container of elements that satisfy the predicate.
+	*  Returns: A container of elements that satisfy the predicate, of the same type as the
+	*  original one if it has push_back modifier or is associative (std::map, std::set,
+	*  std::unordered_map, ...), otherwise a std::vector.
 	* 
 	*  Usage:
 	*  list<int> ls{1,2,3,4,5};
@@ -61,18 +372,71 @@ namespace cql
 	* 
 	*  Minimum C++ standard: C++11.
 	*/
-	template<template<typename...> typename TContainer, typename TElement, typename TFunc>
-	TContainer<TElement> Where(const TContainer<TElement>& container, const TFunc& predicate)
+	template<typename TContainer, typename TFunc>
+	typename QueryResult<TContainer>::type Where(const TContainer& container, const TFunc& predicate)
 	{
-		TContainer<TElement> result;
+		typename QueryResult<TContainer>::type result;
 		for (auto& element : container)
 		{
 			if (predicate(element))
-				result.push_back(element);
+				detail::Append(result, element);
 		}
 		return result;
 	}
 
+	namespace detail
+	{
+		template<typename TContainer, typename TFunc, typename TSetFunc>
+		void UpdateWhere(TContainer& container, const TFunc& predicate, const TSetFunc& setFunc, std::false_type)
+		{
+			for (auto& element : container)
+			{
+				if (predicate(element))
+					setFunc(element);
+			}
+		}
+
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+		// Set elements are their own keys: matching nodes are extracted, updated and
+		// reinserted after the pass, so an updated element is never visited twice.
+		template<typename TContainer, typename TFunc, typename TSetFunc>
+		void UpdateWhere(TContainer& container, const TFunc& predicate, const TSetFunc& setFunc, std::true_type)
+		{
+			std::vector<typename TContainer::node_type> updated;
+			for (auto itr = container.begin(); itr != container.end();)
+			{
+				if (predicate(*itr))
+				{
+					updated.push_back(container.extract(itr++));
+					setFunc(updated.back().value());
+				}
+				else
+					++itr;
+			}
+			for (auto& node : updated)
+				container.insert(std::move(node));
+		}
+#endif
+
+		template<typename TContainer, typename TFunc>
+		void DeleteWhere(TContainer& container, const TFunc& predicate, std::false_type)
+		{
+			container.erase(std::remove_if(container.begin(), container.end(), predicate), container.end());
+		}
+
+		template<typename TContainer, typename TFunc>
+		void DeleteWhere(TContainer& container, const TFunc& predicate, std::true_type)
+		{
+			for (auto itr = container.begin(); itr != container.end();)
+			{
+				if (predicate(*itr))
+					itr = container.erase(itr);
+				else
+					++itr;
+			}
+		}
+	}
+
 	/* Update Statement:
 	*  It updates a container based on an updating function.
 	*
@@ -84,10 +448,7 @@ namespace cql
 	template<typename TContainer, typename TSetFunc>
 	void Update(TContainer& container, const TSetFunc& setFunc)
 	{
-		for (auto& element : container)
-		{
-			setFunc(element);
-		}
+		detail::UpdateWhere(container, [](const typename RangeValue<TContainer>::type&) { return true; }, setFunc, IsSetLike<TContainer>());
 	}
 
 	/* Update Statement:
@@ -98,19 +459,19 @@ namespace cql
 	*  auto set = [](int& v){ v = 10; };
 	*  auto predicate = [](const int& v){ return v%2 == 0; };
 	*  Update(ls, predicate, set);
+	*
+	*  On sets (whose elements are their keys) matching elements are re-inserted after
+	*  the update, which requires C++17.
 	*/
 	template<typename TContainer, typename TFunc, typename TSetFunc>
 	void Update(TContainer& container, const TFunc& predicate, const TSetFunc& setFunc)
 	{
-		for (auto &element : container)
-		{
-			if (predicate(element))
-				setFunc(element);
-		}
+		detail::UpdateWhere(container, predicate, setFunc, IsSetLike<TContainer>());
 	}
 
 	/* Delete Statement:
-	*  It removes elements from a container based on a predicate.
+	*  It removes elements from a container based on a predicate. Associative containers
+	*  are erased node by node.
 	*
 	*  Usage:
 	*  list<int> ls{1,7,3,4,7};
@@ -120,12 +481,15 @@ namespace cql
 	template<typename TContainer, typename TFunc>
 	void Delete(TContainer& container, const TFunc& predicate)
 	{
-		container.erase(std::remove_if(container.begin(), container.end(), predicate), container.end());		
+		detail::DeleteWhere(container, predicate, IsAssociative<TContainer>());
 	}
 
 #if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
 	/* OrderBy:
-	*  It sorts std::vector and std::list containers of any type based on an ordering function.
+	*  It sorts containers of any type based on an ordering function. Containers with
+	*  a sort member (std::list, std::forward_list) use it, random-access ranges
+	*  (std::vector, std::deque, std::array, std::span) are sorted in place, other
+	*  ranges are sorted through a temporary vector.
 	* 
 	*  Usage:
 	*  struct MyStruct{ int x,y; };
@@ -138,48 +502,96 @@ namespace cql
 	template<typename TContainer, typename TFunc>
 	void OrderBy(TContainer& container, const TFunc& func)
 	{
-		if constexpr (IsVector<TContainer>::value)
+		if constexpr (HasMemberSort<TContainer>::value)
 		{
-			std::sort(container.begin(), container.end(), func);
+			container.sort(func);
 		}
-		if constexpr (IsList<TContainer>::value)
+		else if constexpr (IsRandomAccessRange<TContainer>::value)
 		{
-			container.sort(func);
+			std::sort(std::begin(container), std::end(container), func);
+		}
+		else
+		{
+			std::vector<typename RangeValue<TContainer>::type> sorted(
+				std::make_move_iterator(std::begin(container)), std::make_move_iterator(std::end(container)));
+			std::sort(sorted.begin(), sorted.end(), func);
+			std::move(sorted.begin(), sorted.end(), std::begin(container));
 		}
 	}
 
 	/* Distinct:
 	*
-	*  Returns: a distinct container of the original one.
+	*  Returns: a distinct container of the original one, of the same type if it can
+	*  erase elements (std::vector, std::deque, std::list) or already holds each key once
+	*  (std::set, std::map, ...), otherwise a sorted std::vector.
 	*
 	*  Usage:
 	*  list<int> ls{ 11,11,2,2,3,5,6 };
 	*  auto res = Distinct(ls);
 	*/
 	template<typename TContainer>
-	TContainer Distinct(const TContainer& container)
+	auto Distinct(const TContainer& container)
 	{
-		TContainer result = container;
-		if constexpr (IsVector<TContainer>::value)
+		if constexpr (HasUniqueKeys<TContainer>::value)
 		{
-			std::sort(result.begin(), result.end());
-			result.erase(std::unique(result.begin(), result.end()), result.end());
+			return container;
 		}
-		if constexpr (IsList<TContainer>::value)
+		else if constexpr (HasMemberSort<TContainer>::value)
 		{
+			TContainer result = container;
 			result.sort();
 			result.unique();
+			return result;
+		}
+		else if constexpr (IsRandomAccessRange<TContainer>::value && HasRangeErase<TContainer>::value)
+		{
+			TContainer result = container;
+			std::sort(result.begin(), result.end());
+			result.erase(std::unique(result.begin(), result.end()), result.end());
+			return result;
+		}
+		else
+		{
+			std::vector<typename RangeValue<TContainer>::type> result(std::begin(container), std::end(container));
+			std::sort(result.begin(), result.end());
+			result.erase(std::unique(result.begin(), result.end()), result.end());
+			return result;
 		}
-		return result;
 	}
 #endif
 
 #if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201402L) || __cplusplus >= 201402L)
+	namespace detail
+	{
+		template<typename TContainer, typename TGroupingMemberFunc, typename TCheckpoint>
+		auto GroupBy(const TContainer& container, 
+			const TGroupingMemberFunc& groupingMemberFunc, 
+			TCheckpoint& checkpoint, 
+			const char* phase = "GroupBy")
+		{
+			using GroupingMemberType = std::decay_t<decltype(groupingMemberFunc(*std::begin(container)))>;
+			using KeyTraits = GroupingKeyTraits<GroupingMemberType>;
+			using GroupType = typename QueryResult<TContainer>::type;
+			std::map<typename KeyTraits::StorageType, GroupType, typename KeyTraits::Compare> result;
+			checkpoint.BeginPhase(phase, container);
+			for (auto& elem : container)
+			{
+				checkpoint.Step();
+				auto&& key = groupingMemberFunc(elem);
+				auto itr = result.lower_bound(key);
+				if (itr == result.end() || result.key_comp()(key, itr->first))
+					itr = result.emplace_hint(itr, typename KeyTraits::StorageType(key), GroupType());
+				detail::Append(itr->second, elem);
+			}
+			return result;
+		}
+	}
+
 	/* GroupBy:
 	*  It groups containers of any type based on any data member of that type.
 	* 
 	*  Returns: a map whose key is the grouping data member and whose value is a container
-	*  of elements share the same value of the key.
+	*  of elements share the same value of the key (see QueryResult for the container type).
 	* 
 	*  Usage:
 	*  struct MyStruct{ int x,y; };
@@ -189,21 +601,199 @@ namespace cql
 	* 
 	*  Minimum C++ standard: C++14.
 	*/
-	template<template<typename...> typename TContainer, 
-		typename TElement, 
-		typename TGroupingMemberFunc>
-	auto GroupBy(const TContainer<TElement>& container, const TGroupingMemberFunc& groupingMemberFunc)
+	template<typename TContainer, typename TGroupingMemberFunc>
+	auto GroupBy(const TContainer& container, const TGroupingMemberFunc& groupingMemberFunc)
+	{
+		detail::NoCheckpoint checkpoint;
+		return detail::GroupBy(container, groupingMemberFunc, checkpoint);
+	}
+
+	/* GroupView:
+	*  A read-only view over one group of a CompactGroups result.
+	*/
+	template<typename TElement>
+	class GroupView
+	{
+	public:
+		GroupView() = default;
+		GroupView(const TElement* first, const TElement* last) : first_(first), last_(last) {}
+
+		const TElement* begin() const { return first_; }
+		const TElement* end() const { return last_; }
+		size_t size() const { return static_cast<size_t>(last_ - first_); }
+		bool empty() const { return first_ == last_; }
+		const TElement& operator[](size_t index) const { return first_[index]; }
+		const TElement& front() const { return *first_; }
+		const TElement& back() const { return *(last_ - 1); }
+
+	private:
+		const TElement* first_ = nullptr;
+		const TElement* last_ = nullptr;
+	};
+
+	/* CompactGroups:
+	*  Groups stored in one contiguous buffer with an offsets array (CSR layout),
+	*  group i occupies Elements()[Offsets()[i] .. Offsets()[i + 1]).
+	*  Keys are kept in ascending order, so lookups by key are binary searches.
+	*/
+	template<typename TKey, typename TElement>
+	class CompactGroups
+	{
+	public:
+		CompactGroups() : offsets_{ 0 } {}
+		CompactGroups(std::vector<TKey> keys, std::vector<size_t> offsets, std::vector<TElement> elements)
+			: keys_(std::move(keys)), offsets_(std::move(offsets)), elements_(std::move(elements)) {}
+
+		size_t size() const { return keys_.size(); }
+		bool empty() const { return keys_.empty(); }
+
+		const TKey& Key(size_t index) const { return keys_[index]; }
+		GroupView<TElement> Group(size_t index) const
+		{
+			return GroupView<TElement>(elements_.data() + offsets_[index], elements_.data() + offsets_[index + 1]);
+		}
+
+		bool Contains(const TKey& key) const { return std::binary_search(keys_.begin(), keys_.end(), key); }
+
+		// Returns an empty view when the key is absent.
+		GroupView<TElement> Find(const TKey& key) const
+		{
+			auto itr = std::lower_bound(keys_.begin(), keys_.end(), key);
+			if (itr == keys_.end() || key < *itr)
+				return GroupView<TElement>();
+			return Group(static_cast<size_t>(itr - keys_.begin()));
+		}
+		GroupView<TElement> operator[](const TKey& key) const { return Find(key); }
+
+		const std::vector<TKey>& Keys() const { return keys_; }
+		const std::vector<size_t>& Offsets() const { return offsets_; }
+		const std::vector<TElement>& Elements() const { return elements_; }
+
+	private:
+		std::vector<TKey> keys_;
+		std::vector<size_t> offsets_;
+		std::vector<TElement> elements_;
+	};
+
+	/* GroupByCompact:
+	*  Same grouping as GroupBy, but all groups share one element buffer instead of
+	*  one container per group, so the number of allocations does not depend on
+	*  the number of groups. Elements keep their original order inside a group.
+	*
+	*  Returns: a CompactGroups whose keys are the grouping data member.
+	*
+	*  Usage:
+	*  struct MyStruct{ int x,y; };
+	*  vector<MyStruct> ls{ {1,4} ,{3,4} ,{1,4}, {2,7}, {1,1}};
+	*  auto res = GroupByCompact(ls, [](const MyStruct& myStruct) { return myStruct.x; });
+	*  for (auto& elem : res[1]) { ... }
+	*
+	*  Minimum C++ standard: C++14.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc>
+	auto GroupByCompact(const TContainer& container, const TGroupingMemberFunc& groupingMemberFunc)
 	{
-		TElement containerElement;
-		using GroupingMemberType = decltype(groupingMemberFunc(containerElement));
-		std::map<GroupingMemberType, TContainer<TElement>> result;
+		using TElement = typename RangeValue<TContainer>::type;
+		using GroupingMemberType = std::decay_t<decltype(groupingMemberFunc(*std::begin(container)))>;
+		using StorageType = typename GroupingKeyTraits<GroupingMemberType>::StorageType;
+
+		std::vector<std::pair<GroupingMemberType, const TElement*>> keyed;
+		keyed.reserve(static_cast<size_t>(std::distance(std::begin(container), std::end(container))));
 		for (auto& elem : container)
 		{
-			result[groupingMemberFunc(elem)].push_back(elem);
+			keyed.emplace_back(groupingMemberFunc(elem), &elem);
+		}
+		std::stable_sort(keyed.begin(), keyed.end(), [](const auto& l, const auto& r) { return l.first < r.first; });
+
+		std::vector<StorageType> keys;
+		std::vector<size_t> offsets;
+		std::vector<TElement> elements;
+		elements.reserve(keyed.size());
+		for (size_t i = 0; i < keyed.size(); i++)
+		{
+			if (i == 0 || keyed[i - 1].first < keyed[i].first)
+			{
+				keys.push_back(StorageType(keyed[i].first));
+				offsets.push_back(i);
+			}
+			elements.push_back(*keyed[i].second);
+		}
+		offsets.push_back(elements.size());
+
+		return CompactGroups<StorageType, TElement>(std::move(keys), std::move(offsets), std::move(elements));
+	}
+
+	/* AggregateBy:
+	*  It folds the elements of each group into an accumulator instead of copying them
+	*  into per-group containers, so memory is bounded by the number of groups. Works
+	*  over single-pass sources (DelimitedReader, WhereView over it).
+	*
+	*  Returns: a map whose key is the grouping data member and whose value is the
+	*  accumulated value of the group's elements.
+	*
+	*  Usage:
+	*  struct MyStruct{ int x,y; };
+	*  vector<MyStruct> ls{ {1,4} ,{3,4} ,{1,4}, {2,7}, {1,1}};
+	*  auto res = AggregateBy(ls, [](const MyStruct& s) { return s.x; }, 0,
+	*      [](int sum, const MyStruct& s) { return sum + s.y; });  // [1,9], [2,7], [3,4]
+	*
+	*  Minimum C++ standard: C++14.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc, typename TAccumulator, typename TAccumulateFunc>
+	auto AggregateBy(TContainer&& container, 
+		const TGroupingMemberFunc& groupingMemberFunc, 
+		const TAccumulator& seed, 
+		const TAccumulateFunc& accumulateFunc)
+	{
+		using GroupingMemberType = std::decay_t<decltype(groupingMemberFunc(*std::begin(container)))>;
+		using KeyTraits = GroupingKeyTraits<GroupingMemberType>;
+		std::map<typename KeyTraits::StorageType, TAccumulator, typename KeyTraits::Compare> result;
+		for (auto&& elem : container)
+		{
+			auto&& key = groupingMemberFunc(elem);
+			auto itr = result.lower_bound(key);
+			if (itr == result.end() || result.key_comp()(key, itr->first))
+				itr = result.emplace_hint(itr, typename KeyTraits::StorageType(key), seed);
+			itr->second = accumulateFunc(std::move(itr->second), elem);
 		}
 		return result;
 	}
 
+	namespace detail
+	{
+		template<typename TContainer1,
+			typename TContainer2,
+			typename TJoiningMemberFunc1, 
+			typename TJoiningMemberFunc2,
+			typename TCheckpoint>
+		auto Join(const TContainer1& container1, 
+			const TContainer2& container2, 
+			const TJoiningMemberFunc1& joiningMemberFunc1, 
+			const TJoiningMemberFunc2& joiningMemberFunc2,
+			TCheckpoint& checkpoint)
+		{
+			using GroupingMemberType = std::decay_t<decltype(joiningMemberFunc1(*std::begin(container1)))>;
+			using KeyTraits = GroupingKeyTraits<GroupingMemberType>;
+			std::map<typename KeyTraits::StorageType, 
+				std::pair<typename QueryResult<TContainer1>::type, typename QueryResult<TContainer2>::type>, 
+				typename KeyTraits::Compare> result;
+
+			auto group1 = detail::GroupBy(container1, joiningMemberFunc1, checkpoint, "Join: grouping first");
+			auto group2 = detail::GroupBy(container2, joiningMemberFunc2, checkpoint, "Join: grouping second");
+
+			checkpoint.BeginPhase("Join: matching", group1);
+			for (auto& elem : group1)
+			{
+				checkpoint.Step();
+				auto match = group2.find(elem.first);
+				if (match != group2.end())
+					result[elem.first] = std::make_pair(elem.second, match->second);
+			}
+
+			return result;
+		}
+	}
+
 	/* Join:
 	*  It joins 2 containers of any type based on shared data member.
 	* 
@@ -221,59 +811,4408 @@ namespace cql
 	* 
 	*  Minimum C++ standard: C++14.
 	*/
-	template<template<typename...> typename TContainer1,
-		template<typename...> typename TContainer2,
-		typename TElement1, 
-		typename TElement2, 
+	template<typename TContainer1,
+		typename TContainer2,
 		typename TJoiningMemberFunc1, 
 		typename TJoiningMemberFunc2>
-	auto Join(const TContainer1<TElement1>& container1, 
-		const TContainer2<TElement2>& container2, 
+	auto Join(const TContainer1& container1, 
+		const TContainer2& container2, 
 		const TJoiningMemberFunc1& joiningMemberFunc1, 
 		const TJoiningMemberFunc2& joiningMemberFunc2)
 	{
-		TElement1 containerElement1;
-		using GroupingMemberType = decltype(joiningMemberFunc1(containerElement1));
-		std::map<GroupingMemberType, std::pair<TContainer1<TElement1>, TContainer2<TElement2>>> result;
+		detail::NoCheckpoint checkpoint;
+		return detail::Join(container1, container2, joiningMemberFunc1, joiningMemberFunc2, checkpoint);
+	}
+#endif
 
-		auto group1 = GroupBy(container1, joiningMemberFunc1);
-		auto group2 = GroupBy(container2, joiningMemberFunc2);
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+	namespace detail
+	{
+		// Control bytes of FlatHashTable slots: a full slot holds the low 7 bits of its
+		// key's hash, free slots have the sign bit set.
+		constexpr int8_t CtrlEmpty = -128;
+		constexpr int8_t CtrlDeleted = -2;
+		constexpr size_t GroupWidth = 16;
 
-		for (auto& elem : group1)
+		inline uint32_t CountTrailingZeros(uint32_t mask)
 		{
-			if (group2.find(elem.first) != group2.end())
-				result[elem.first] = std::make_pair(elem.second, group2[elem.first]);
+#if defined(_MSC_VER) && !defined(__clang__)
+			unsigned long index;
+			_BitScanForward(&index, mask);
+			return static_cast<uint32_t>(index);
+#else
+			return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
 		}
 
-		return result;
-	}
+		// Bit i is set when control byte i of the group equals value.
+		inline uint32_t MatchControl(const int8_t* group, int8_t value)
+		{
+#if defined(CONTAINER_QUERY_LIBRARY_SSE2)
+			__m128i control = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(control, _mm_set1_epi8(value))));
+#else
+			uint32_t mask = 0;
+			for (size_t i = 0; i < GroupWidth; i++)
+				mask |= static_cast<uint32_t>(group[i] == value) << i;
+			return mask;
 #endif
+		}
 
-#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
-	template<template<typename...> typename TContainer, typename TElement, typename TFunc>
-	std::experimental::generator<TElement> WhereLazy(const TContainer<TElement>& container, const TFunc& predicate)
-	{
-		for (auto& element : container)
+		// Bit i is set when slot i of the group is empty or deleted.
+		inline uint32_t MatchFree(const int8_t* group)
 		{
-			if (predicate(element))
-				co_yield(element);
+#if defined(CONTAINER_QUERY_LIBRARY_SSE2)
+			return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+			uint32_t mask = 0;
+			for (size_t i = 0; i < GroupWidth; i++)
+				mask |= static_cast<uint32_t>(group[i] < 0) << i;
+			return mask;
+#endif
 		}
-	}
 
-	template<template<typename...> typename TContainer, typename TElement>
-	std::experimental::generator<TElement> DistinctLazy(const TContainer<TElement>& container)
-	{
-		TContainer<TElement> result;
-		for (auto& element : container)
+		template<typename Type, typename = void>
+		struct IsTransparent : public std::false_type {};
+		template<typename Type>
+		struct IsTransparent<Type, typename MakeVoid<typename Type::is_transparent>::type> : public std::true_type {};
+
+		// Tables whose hasher and key comparison both accept other key types, such as
+		// std::string_view for std::string keys.
+		template<typename TTable>
+		struct IsTransparentTable : public std::integral_constant<bool,
+			IsTransparent<typename TTable::hasher>::value && IsTransparent<typename TTable::key_equal>::value> {};
+
+		// std::hash is the identity for integers on common standard libraries, which
+		// would put consecutive keys in the same group; spread the bits first.
+		inline size_t MixHash(size_t hash)
 		{
-			if (std::find(result.begin(), result.end(), element) == result.end())
-			{
-				result.push_back(element);
-				co_yield(element);
-			}
+			uint64_t mixed = static_cast<uint64_t>(hash) * 0x9E3779B97F4A7C15ull;
+			return static_cast<size_t>(mixed ^ (mixed >> 32));
 		}
-	}
-#endif
-}
+
+		template<typename TKey, typename TValue>
+		struct FlatMapPolicy
+		{
+			using value_type = std::pair<const TKey, TValue>;
+			static constexpr bool ConstElements = false;
+			static const TKey& Key(const value_type& value) { return value.first; }
+		};
+
+		template<typename TKey>
+		struct FlatSetPolicy
+		{
+			using value_type = TKey;
+			static constexpr bool ConstElements = true;
+			static const TKey& Key(const value_type& value) { return value; }
+		};
+
+		/* FlatHashTable:
+		*  The open-addressing table behind FlatHashMap and FlatHashSet, laid out like a
+		*  Swiss table: elements are stored inline in one slot array, with a parallel array
+		*  of one control byte per slot. A lookup hashes the key once, then scans groups of
+		*  16 control bytes for the hash's low 7 bits (one SSE2 compare per group where
+		*  available), so the key itself is compared only on likely matches. The table
+		*  grows at 7/8 load; erased slots become tombstones unless their group still has
+		*  an empty slot. When the hasher and key comparison are transparent, lookups also
+		*  accept any key type they take, without converting it to TKey.
+		*/
+		template<typename TKey, typename TPolicy, typename THash, typename TEqual>
+		class FlatHashTable
+		{
+		public:
+			using key_type = TKey;
+			using value_type = typename TPolicy::value_type;
+			using hasher = THash;
+			using key_equal = TEqual;
+
+			template<bool IsConst>
+			class Iterator
+			{
+				using Table = std::conditional_t<IsConst, const FlatHashTable, FlatHashTable>;
+
+			public:
+				using iterator_category = std::forward_iterator_tag;
+				using value_type = typename FlatHashTable::value_type;
+				using difference_type = std::ptrdiff_t;
+				using reference = std::conditional_t<IsConst || TPolicy::ConstElements, const value_type&, value_type&>;
+				using pointer = std::conditional_t<IsConst || TPolicy::ConstElements, const value_type*, value_type*>;
+
+				Iterator() = default;
+				Iterator(Table* table, size_t index) : table_(table), index_(index) { SkipFree(); }
+				template<bool ToConst = true, typename = std::enable_if_t<ToConst && !IsConst>>
+				operator Iterator<ToConst>() const { return Iterator<ToConst>(table_, index_); }
+
+				reference operator*() const { return table_->Slot(index_); }
+				pointer operator->() const { return &table_->Slot(index_); }
+				Iterator& operator++() { index_++; SkipFree(); return *this; }
+				Iterator operator++(int) { Iterator copy = *this; ++*this; return copy; }
+				bool operator==(const Iterator& other) const { return index_ == other.index_; }
+				bool operator!=(const Iterator& other) const { return index_ != other.index_; }
+
+			private:
+				friend class FlatHashTable;
+
+				void SkipFree()
+				{
+					while (index_ < table_->capacity_ && table_->control_[index_] < 0)
+						index_++;
+				}
+
+				Table* table_ = nullptr;
+				size_t index_ = 0;
+			};
+			using iterator = Iterator<false>;
+			using const_iterator = Iterator<true>;
+
+		protected:
+			// Heterogeneous overloads exist only for transparent tables and never shadow the
+			// TKey, iterator and const_iterator ones.
+			template<typename TLookup>
+			using EnableLookup = std::enable_if_t<IsTransparent<THash>::value && IsTransparent<TEqual>::value &&
+				!std::is_same<TLookup, TKey>::value && !std::is_same<TLookup, iterator>::value && !std::is_same<TLookup, const_iterator>::value>;
+
+		public:
+
+			FlatHashTable() = default;
+			FlatHashTable(const FlatHashTable& other) : hash_(other.hash_), equal_(other.equal_)
+			{
+				reserve(other.size_);
+				for (auto& value : other)
+					Emplace(TPolicy::Key(value), value);
+			}
+			FlatHashTable(FlatHashTable&& other) noexcept { Swap(other); }
+			FlatHashTable& operator=(FlatHashTable other) noexcept
+			{
+				Swap(other);
+				return *this;
+			}
+			~FlatHashTable() { DestroyAll(); }
+
+			size_t size() const { return size_; }
+			bool empty() const { return size_ == 0; }
+			size_t capacity() const { return capacity_; }
+			hasher hash_function() const { return hash_; }
+			key_equal key_eq() const { return equal_; }
+
+			iterator begin() { return iterator(this, 0); }
+			iterator end() { return iterator(this, capacity_); }
+			const_iterator begin() const { return const_iterator(this, 0); }
+			const_iterator end() const { return const_iterator(this, capacity_); }
+
+			iterator find(const TKey& key) { return iterator(this, FindIndex(key, MixHash(hash_(key)))); }
+			const_iterator find(const TKey& key) const { return const_iterator(this, FindIndex(key, MixHash(hash_(key)))); }
+			bool contains(const TKey& key) const { return FindIndex(key, MixHash(hash_(key))) != capacity_; }
+			size_t count(const TKey& key) const { return contains(key) ? 1 : 0; }
+
+			template<typename TLookup, typename = EnableLookup<TLookup>>
+			iterator find(const TLookup& key) { return iterator(this, FindIndex(key, MixHash(hash_(key)))); }
+			template<typename TLookup, typename = EnableLookup<TLookup>>
+			const_iterator find(const TLookup& key) const { return const_iterator(this, FindIndex(key, MixHash(hash_(key)))); }
+			template<typename TLookup, typename = EnableLookup<TLookup>>
+			bool contains(const TLookup& key) const { return FindIndex(key, MixHash(hash_(key))) != capacity_; }
+			template<typename TLookup, typename = EnableLookup<TLookup>>
+			size_t count(const TLookup& key) const { return contains(key) ? 1 : 0; }
+
+			iterator erase(const_iterator position)
+			{
+				EraseAt(position.index_);
+				return iterator(this, position.index_ + 1);
+			}
+			iterator erase(iterator position) { return erase(const_iterator(position)); }
+
+			size_t erase(const TKey& key) { return EraseKey(key); }
+			template<typename TLookup, typename = EnableLookup<TLookup>>
+			size_t erase(const TLookup& key) { return EraseKey(key); }
+
+			void clear()
+			{
+				DestroyAll();
+				if (capacity_ > 0)
+					std::fill(control_.get(), control_.get() + capacity_, CtrlEmpty);
+				size_ = 0;
+				growthLeft_ = MaxLoad(capacity_);
+			}
+
+			void reserve(size_t count)
+			{
+				size_t capacity = GroupWidth;
+				while (MaxLoad(capacity) < count)
+					capacity *= 2;
+				if (capacity > capacity_)
+					Rehash(capacity);
+			}
+
+		protected:
+			// Inserts the value built from args unless key is already present.
+			template<typename... TArgs>
+			std::pair<iterator, bool> Emplace(const TKey& key, TArgs&&... args)
+			{
+				size_t hash = MixHash(hash_(key));
+				size_t index = FindIndex(key, hash);
+				if (index != capacity_)
+					return { iterator(this, index), false };
+
+				if (growthLeft_ == 0)
+					Rehash(size_ < MaxLoad(capacity_) / 2 ? capacity_ : (std::max)(capacity_ * 2, GroupWidth));
+				index = FindFree(hash);
+				new (&slots_[index]) value_type(std::forward<TArgs>(args)...);
+				if (control_[index] == CtrlEmpty)
+					growthLeft_--;
+				control_[index] = static_cast<int8_t>(hash & 0x7F);
+				size_++;
+				return { iterator(this, index), true };
+			}
+
+		private:
+			struct alignas(value_type) SlotStorage
+			{
+				unsigned char bytes[sizeof(value_type)];
+			};
+
+			static size_t MaxLoad(size_t capacity) { return capacity - capacity / 8; }
+
+			value_type& Slot(size_t index) const { return *std::launder(reinterpret_cast<value_type*>(slots_[index].bytes)); }
+
+			template<typename TLookup>
+			size_t FindIndex(const TLookup& key, size_t hash) const
+			{
+				if (capacity_ == 0)
+					return capacity_;
+				size_t groupMask = capacity_ / GroupWidth - 1;
+				size_t group = (hash >> 7) & groupMask;
+				for (size_t step = 1; step <= groupMask + 1; step++)
+				{
+					const int8_t* control = control_.get() + group * GroupWidth;
+					for (uint32_t mask = MatchControl(control, static_cast<int8_t>(hash & 0x7F)); mask != 0; mask &= mask - 1)
+					{
+						size_t index = group * GroupWidth + CountTrailingZeros(mask);
+						if (equal_(TPolicy::Key(Slot(index)), key))
+							return index;
+					}
+					if (MatchControl(control, CtrlEmpty) != 0)
+						break;
+					group = (group + step) & groupMask;
+				}
+				return capacity_;
+			}
+
+			template<typename TLookup>
+			size_t EraseKey(const TLookup& key)
+			{
+				size_t index = FindIndex(key, MixHash(hash_(key)));
+				if (index == capacity_)
+					return 0;
+				EraseAt(index);
+				return 1;
+			}
+
+			size_t FindFree(size_t hash) const
+			{
+				size_t groupMask = capacity_ / GroupWidth - 1;
+				size_t group = (hash >> 7) & groupMask;
+				for (size_t step = 1;; step++)
+				{
+					uint32_t mask = MatchFree(control_.get() + group * GroupWidth);
+					if (mask != 0)
+						return group * GroupWidth + CountTrailingZeros(mask);
+					group = (group + step) & groupMask;
+				}
+			}
+
+			void EraseAt(size_t index)
+			{
+				Slot(index).~value_type();
+				size_--;
+				// A group that still has an empty slot never made a probe move on, so the
+				// slot can become empty again instead of a tombstone.
+				if (MatchControl(control_.get() + index / GroupWidth * GroupWidth, CtrlEmpty) != 0)
+				{
+					control_[index] = CtrlEmpty;
+					growthLeft_++;
+				}
+				else
+					control_[index] = CtrlDeleted;
+			}
+
+			void Rehash(size_t capacity)
+			{
+				FlatHashTable rehashed;
+				rehashed.hash_ = hash_;
+				rehashed.equal_ = equal_;
+				rehashed.capacity_ = capacity;
+				rehashed.control_.reset(new int8_t[capacity]);
+				std::fill(rehashed.control_.get(), rehashed.control_.get() + capacity, CtrlEmpty);
+				rehashed.slots_.reset(new SlotStorage[capacity]);
+				rehashed.growthLeft_ = MaxLoad(capacity);
+				for (size_t i = 0; i < capacity_; i++)
+				{
+					if (control_[i] < 0)
+						continue;
+					size_t hash = MixHash(hash_(TPolicy::Key(Slot(i))));
+					size_t index = rehashed.FindFree(hash);
+					new (&rehashed.slots_[index]) value_type(std::move(Slot(i)));
+					rehashed.control_[index] = static_cast<int8_t>(hash & 0x7F);
+					rehashed.growthLeft_--;
+					rehashed.size_++;
+				}
+				Swap(rehashed);
+			}
+
+			void DestroyAll()
+			{
+				if (!std::is_trivially_destructible<value_type>::value)
+				{
+					for (size_t i = 0; i < capacity_; i++)
+					{
+						if (control_[i] >= 0)
+							Slot(i).~value_type();
+					}
+				}
+			}
+
+			void Swap(FlatHashTable& other) noexcept
+			{
+				std::swap(control_, other.control_);
+				std::swap(slots_, other.slots_);
+				std::swap(capacity_, other.capacity_);
+				std::swap(size_, other.size_);
+				std::swap(growthLeft_, other.growthLeft_);
+				std::swap(hash_, other.hash_);
+				std::swap(equal_, other.equal_);
+			}
+
+			std::unique_ptr<int8_t[]> control_;
+			std::unique_ptr<SlotStorage[]> slots_;
+			size_t capacity_ = 0;
+			size_t size_ = 0;
+			size_t growthLeft_ = 0;
+			THash hash_;
+			TEqual equal_;
+		};
+	}
+
+	/* FlatHashMap:
+	*  A hash map with unordered_map's core interface on top of an open-addressing
+	*  Swiss-table layout (see detail::FlatHashTable): no allocation per element, one
+	*  hash per operation and SIMD matching of candidate slots. The cql operators that
+	*  hash keys use it. Iterators and references are invalidated by inserts that grow
+	*  the table, and by rehashing.
+	*
+	*  Usage:
+	*  FlatHashMap<std::string, int> counts;
+	*  counts["a"]++;
+	*  if (auto itr = counts.find("a"); itr != counts.end()) ...
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TKey, typename TValue, typename THash = typename detail::DefaultHashing<TKey>::Hash, typename TEqual = typename detail::DefaultHashing<TKey>::Equal>
+	class FlatHashMap : public detail::FlatHashTable<TKey, detail::FlatMapPolicy<TKey, TValue>, THash, TEqual>
+	{
+		using Base = detail::FlatHashTable<TKey, detail::FlatMapPolicy<TKey, TValue>, THash, TEqual>;
+
+	public:
+		using mapped_type = TValue;
+		using typename Base::value_type;
+		using typename Base::iterator;
+		using typename Base::const_iterator;
+
+		template<typename... TArgs>
+		std::pair<iterator, bool> try_emplace(const TKey& key, TArgs&&... args)
+		{
+			return this->Emplace(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<TArgs>(args)...));
+		}
+
+		template<typename... TArgs>
+		std::pair<iterator, bool> try_emplace(TKey&& key, TArgs&&... args)
+		{
+			return this->Emplace(key, std::piecewise_construct, std::forward_as_tuple(std::move(key)), std::forward_as_tuple(std::forward<TArgs>(args)...));
+		}
+
+		template<typename TValueArg>
+		std::pair<iterator, bool> emplace(const TKey& key, TValueArg&& value) { return try_emplace(key, std::forward<TValueArg>(value)); }
+		std::pair<iterator, bool> insert(const value_type& value) { return this->Emplace(value.first, value); }
+		// The hint is ignored; it lets cql's generic queries insert into any associative container.
+		iterator insert(const_iterator, const value_type& value) { return insert(value).first; }
+		template<typename TIterator>
+		void insert(TIterator first, TIterator last)
+		{
+			for (; first != last; ++first)
+				insert(*first);
+		}
+
+		TValue& operator[](const TKey& key) { return try_emplace(key).first->second; }
+		TValue& operator[](TKey&& key) { return try_emplace(std::move(key)).first->second; }
+
+		TValue& at(const TKey& key) { return At(*this, key); }
+		const TValue& at(const TKey& key) const { return At(*this, key); }
+		template<typename TLookup, typename = typename Base::template EnableLookup<TLookup>>
+		TValue& at(const TLookup& key) { return At(*this, key); }
+		template<typename TLookup, typename = typename Base::template EnableLookup<TLookup>>
+		const TValue& at(const TLookup& key) const { return At(*this, key); }
+
+	private:
+		template<typename TMap, typename TLookup>
+		static auto& At(TMap& map, const TLookup& key)
+		{
+			auto itr = map.find(key);
+			if (itr == map.end())
+				throw std::out_of_range("cql::FlatHashMap: key not found");
+			return itr->second;
+		}
+	};
+
+	/* FlatHashSet:
+	*  The set counterpart of FlatHashMap.
+	*
+	*  Usage:
+	*  FlatHashSet<int> seen;
+	*  if (seen.insert(id).second) ...
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TKey, typename THash = typename detail::DefaultHashing<TKey>::Hash, typename TEqual = typename detail::DefaultHashing<TKey>::Equal>
+	class FlatHashSet : public detail::FlatHashTable<TKey, detail::FlatSetPolicy<TKey>, THash, TEqual>
+	{
+		using Base = detail::FlatHashTable<TKey, detail::FlatSetPolicy<TKey>, THash, TEqual>;
+
+	public:
+		using typename Base::iterator;
+		using typename Base::const_iterator;
+
+		std::pair<iterator, bool> insert(const TKey& key) { return this->Emplace(key, key); }
+		std::pair<iterator, bool> insert(TKey&& key) { return this->Emplace(key, std::move(key)); }
+		// The hint is ignored; it lets cql's generic queries insert into any associative container.
+		iterator insert(const_iterator, const TKey& key) { return insert(key).first; }
+		template<typename TIterator>
+		void insert(TIterator first, TIterator last)
+		{
+			for (; first != last; ++first)
+				insert(*first);
+		}
+	};
+
+	namespace detail
+	{
+		// The key to probe table with for a key function's result: the result itself when the
+		// table is transparent or stores that type, otherwise a converted copy.
+		template<typename TTable, typename TRaw>
+		decltype(auto) ProbeKey(const TRaw& raw)
+		{
+			using KeyType = typename TTable::key_type;
+			if constexpr (std::is_same<TRaw, KeyType>::value || IsTransparentTable<TTable>::value)
+				return (raw);
+			else
+				return KeyType(raw);
+		}
+
+		// map[raw] that converts raw to the stored key type only when inserting a new key.
+		template<typename TMap, typename TRaw>
+		typename TMap::mapped_type& FindOrInsert(TMap& map, const TRaw& raw)
+		{
+			using KeyType = typename TMap::key_type;
+			if constexpr (!std::is_same<TRaw, KeyType>::value && IsTransparentTable<TMap>::value)
+			{
+				auto itr = map.find(raw);
+				if (itr != map.end())
+					return itr->second;
+				return map.try_emplace(KeyType(raw)).first->second;
+			}
+			else
+				return map[ProbeKey<TMap>(raw)];
+		}
+	}
+
+	/* InternedString:
+	*  Stable id of a string in a StringInterner. Ids compare and hash as integers,
+	*  ordering is by interning order, not lexicographic.
+	*/
+	struct InternedString
+	{
+		uint32_t id = 0;
+	};
+
+	inline bool operator==(InternedString l, InternedString r) { return l.id == r.id; }
+	inline bool operator!=(InternedString l, InternedString r) { return l.id != r.id; }
+	inline bool operator<(InternedString l, InternedString r) { return l.id < r.id; }
+
+	/* StringInterner:
+	*  Maps strings to stable ids. Interned text is copied once into arena blocks
+	*  and never moves, so views returned by Lookup stay valid for the interner's lifetime.
+	*  All member functions are safe to call concurrently.
+	*
+	*  Usage:
+	*  StringInterner pool;
+	*  auto res = GroupBy(logs, [&pool](const Log& log) { return pool.Intern(log.url); });
+	*  std::string_view url = pool.Lookup(res.begin()->first);
+	*/
+	class StringInterner
+	{
+	public:
+		explicit StringInterner(size_t blockSize = 64 * 1024) : blockSize_(blockSize) {}
+		StringInterner(const StringInterner&) = delete;
+		StringInterner& operator=(const StringInterner&) = delete;
+
+		InternedString Intern(std::string_view text)
+		{
+			{
+				std::shared_lock<std::shared_mutex> lock(mutex_);
+				auto itr = ids_.find(text);
+				if (itr != ids_.end())
+					return InternedString{ itr->second };
+			}
+			std::unique_lock<std::shared_mutex> lock(mutex_);
+			auto itr = ids_.find(text);
+			if (itr != ids_.end())
+				return InternedString{ itr->second };
+
+			auto id = static_cast<uint32_t>(strings_.size());
+			auto stored = Store(text);
+			strings_.push_back(stored);
+			ids_.emplace(stored, id);
+			return InternedString{ id };
+		}
+
+		std::optional<InternedString> Find(std::string_view text) const
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex_);
+			auto itr = ids_.find(text);
+			if (itr == ids_.end())
+				return std::nullopt;
+			return InternedString{ itr->second };
+		}
+
+		std::string_view Lookup(InternedString interned) const
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex_);
+			return strings_.at(interned.id);
+		}
+
+		size_t size() const
+		{
+			std::shared_lock<std::shared_mutex> lock(mutex_);
+			return strings_.size();
+		}
+
+	private:
+		std::string_view Store(std::string_view text)
+		{
+			if (text.size() > blockSize_ / 4)
+			{
+				// Oversized strings get their own block so the current block keeps its free space.
+				blocks_.emplace_back(new char[text.size()]);
+				std::copy(text.begin(), text.end(), blocks_.back().get());
+				return std::string_view(blocks_.back().get(), text.size());
+			}
+			if (block_ == nullptr || blockUsed_ + text.size() > blockSize_)
+			{
+				blocks_.emplace_back(new char[blockSize_]);
+				block_ = blocks_.back().get();
+				blockUsed_ = 0;
+			}
+			char* destination = block_ + blockUsed_;
+			std::copy(text.begin(), text.end(), destination);
+			blockUsed_ += text.size();
+			return std::string_view(destination, text.size());
+		}
+
+		mutable std::shared_mutex mutex_;
+		FlatHashMap<std::string_view, uint32_t> ids_;
+		std::vector<std::string_view> strings_;
+		std::vector<std::unique_ptr<char[]>> blocks_;
+		char* block_ = nullptr;
+		size_t blockSize_;
+		size_t blockUsed_ = 0;
+	};
+
+	/* InternAll:
+	*  Interns whatever the selector returns for each element of the container.
+	*
+	*  Returns: A vector of interned ids, in container order.
+	*
+	*  Usage:
+	*  StringInterner pool;
+	*  auto urls = Distinct(InternAll(logs, [](const Log& log) { return std::string_view(log.url); }, pool));
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TFunc>
+	std::vector<InternedString> InternAll(const TContainer& container, const TFunc& selector, StringInterner& interner)
+	{
+		std::vector<InternedString> result;
+		result.reserve(container.size());
+		for (auto& element : container)
+		{
+			result.push_back(interner.Intern(selector(element)));
+		}
+		return result;
+	}
+
+	template <typename Type>
+	const Type& UnwrapReference(const Type& value) { return value; }
+	template <typename Type>
+	Type& UnwrapReference(std::reference_wrapper<Type> value) { return value.get(); }
+
+	/* WhereRef Statement:
+	*  Filters a range like Where, but returns references to the matching elements
+	*  instead of copies. Filtering a result of WhereRef again yields references into
+	*  the original range, so chained filters never copy an element.
+	*  The original range must outlive the result and must not reallocate meanwhile.
+	*
+	*  Returns: A vector of std::reference_wrapper to the elements that satisfy the predicate.
+	*
+	*  Usage:
+	*  vector<Record> records = ...;
+	*  auto big = WhereRef(records, [](const Record& r) { return r.size > 100; });
+	*  auto bigAndOld = WhereRef(big, [](const Record& r) { return r.year < 2000; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TFunc>
+	auto WhereRef(const TContainer& container, const TFunc& predicate)
+	{
+		using TElement = std::remove_reference_t<decltype(UnwrapReference(*std::begin(container)))>;
+		std::vector<std::reference_wrapper<const TElement>> result;
+		for (auto& element : container)
+		{
+			const TElement& value = UnwrapReference(element);
+			if (predicate(value))
+				result.push_back(std::cref(value));
+		}
+		return result;
+	}
+
+	/* FilterView:
+	*  A lazy, non-owning range over the elements of another range that satisfy a predicate.
+	*  Elements are tested while iterating, nothing is copied.
+	*/
+	template<typename TContainer, typename TFunc>
+	class FilterView
+	{
+		using BaseIterator = decltype(std::begin(std::declval<TContainer&>()));
+
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = typename std::iterator_traits<BaseIterator>::value_type;
+			using difference_type = typename std::iterator_traits<BaseIterator>::difference_type;
+			using pointer = typename std::iterator_traits<BaseIterator>::pointer;
+			using reference = typename std::iterator_traits<BaseIterator>::reference;
+
+			iterator() = default;
+			iterator(const FilterView* view, BaseIterator current) : view_(view), current_(current) { SkipRejected(); }
+
+			reference operator*() const { return *current_; }
+			pointer operator->() const { return &*current_; }
+			iterator& operator++() { ++current_; SkipRejected(); return *this; }
+			iterator operator++(int) { iterator previous = *this; ++*this; return previous; }
+			bool operator==(const iterator& other) const { return current_ == other.current_; }
+			bool operator!=(const iterator& other) const { return current_ != other.current_; }
+
+		private:
+			void SkipRejected()
+			{
+				while (current_ != std::end(*view_->container_) && !view_->predicate_(*current_))
+					++current_;
+			}
+
+			const FilterView* view_ = nullptr;
+			BaseIterator current_{};
+		};
+		using const_iterator = iterator;
+
+		FilterView(TContainer& container, TFunc predicate) : container_(&container), predicate_(std::move(predicate)) {}
+
+		iterator begin() const { return iterator(this, std::begin(*container_)); }
+		iterator end() const { return iterator(this, std::end(*container_)); }
+		bool empty() const { return begin() == end(); }
+
+	private:
+		TContainer* container_;
+		TFunc predicate_;
+	};
+
+	/* WhereView Statement:
+	*  A lazy version of Where that returns a FilterView referring back into the range.
+	*  The view can be passed to any other query, including another WhereView, and
+	*  also works over single-pass sources such as DelimitedReader.
+	*  The original range must outlive the view.
+	*
+	*  Usage:
+	*  list<int> ls{1,2,3,4,5};
+	*  auto evens = WhereView(ls, [](const int& v){ return v%2 == 0; });
+	*  auto res = GroupBy(evens, [](const int& v){ return v > 2; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TFunc>
+	FilterView<TContainer, TFunc> WhereView(TContainer& container, const TFunc& predicate)
+	{
+		return FilterView<TContainer, TFunc>(container, predicate);
+	}
+
+	/* DenseKeyRange:
+	*  An inclusive range [min, max] of small integer keys (regions 0-255, hours 0-23, ...).
+	*  Passing one to GroupByDense, AggregateByDense or JoinDense makes them index arrays
+	*  by key - min instead of searching a std::map. Ranges wider than MaxSize keys are
+	*  rejected, since every key in the range gets an array slot. Detect scans a container
+	*  for the range its keys actually span and rejects spans wider than maxSize.
+	*
+	*  Usage:
+	*  auto range = DenseKeyRange<int>::Detect(events, [](const Event& e) { return e.hour; });
+	*  if (range) groups = GroupByDense(events, [](const Event& e) { return e.hour; }, *range);
+	*/
+	template<typename TKey>
+	struct DenseKeyRange
+	{
+		static_assert(std::is_integral<TKey>::value, "cql::DenseKeyRange: keys must be integers");
+		using UnsignedKey = std::make_unsigned_t<TKey>;
+		static constexpr size_t MaxSize = size_t(1) << 24;
+
+		DenseKeyRange(TKey minKey, TKey maxKey) : min(minKey), max(maxKey)
+		{
+			if (max < min)
+				throw std::invalid_argument("cql::DenseKeyRange: max is less than min");
+			if (Span(min, max) >= MaxSize)
+				throw std::invalid_argument("cql::DenseKeyRange: range is wider than MaxSize keys");
+		}
+
+		size_t size() const { return Offset(max) + 1; }
+		bool Contains(TKey key) const { return !(key < min) && !(max < key); }
+
+		// The array index of a key; throws std::out_of_range for keys outside the range.
+		size_t Index(TKey key) const
+		{
+			size_t index = Offset(key);
+			if (index > Offset(max))
+				throw std::out_of_range("cql::DenseKeyRange: key outside the declared range");
+			return index;
+		}
+
+		TKey Key(size_t index) const { return static_cast<TKey>(static_cast<UnsignedKey>(static_cast<UnsignedKey>(min) + index)); }
+
+		template<typename TContainer, typename TKeyFunc>
+		static std::optional<DenseKeyRange> Detect(const TContainer& container, const TKeyFunc& keyFunc, size_t maxSize = 1 << 16)
+		{
+			auto first = std::begin(container);
+			auto last = std::end(container);
+			if (first == last)
+				return std::nullopt;
+			TKey minKey = static_cast<TKey>(keyFunc(*first));
+			TKey maxKey = minKey;
+			for (++first; first != last; ++first)
+			{
+				TKey key = static_cast<TKey>(keyFunc(*first));
+				minKey = (std::min)(minKey, key);
+				maxKey = (std::max)(maxKey, key);
+			}
+			if (Span(minKey, maxKey) >= (std::min)(maxSize, MaxSize))
+				return std::nullopt;
+			return DenseKeyRange(minKey, maxKey);
+		}
+
+		TKey min;
+		TKey max;
+
+	private:
+		using SpanType = std::common_type_t<UnsignedKey, size_t>;
+		static SpanType Span(TKey from, TKey to) { return static_cast<UnsignedKey>(static_cast<UnsignedKey>(to) - static_cast<UnsignedKey>(from)); }
+		size_t Offset(TKey key) const { return static_cast<size_t>(Span(min, key)); }
+	};
+
+	namespace detail
+	{
+		// Elements bucketed by dense key index with a counting pass: bucket i holds
+		// Ordered()[offsets[i] .. offsets[i + 1]) in their original order.
+		template<typename TElement>
+		struct DenseBuckets
+		{
+			std::vector<size_t> offsets;
+			std::vector<const TElement*> ordered;
+
+			size_t Count(size_t index) const { return offsets[index + 1] - offsets[index]; }
+		};
+
+		template<typename TContainer, typename TKeyFunc, typename TKey>
+		auto MakeDenseBuckets(const TContainer& container, const TKeyFunc& keyFunc, const DenseKeyRange<TKey>& range)
+		{
+			using TElement = typename RangeValue<TContainer>::type;
+			DenseBuckets<TElement> buckets;
+			buckets.offsets.assign(range.size() + 1, 0);
+
+			std::vector<std::pair<size_t, const TElement*>> indexed;
+			indexed.reserve(static_cast<size_t>(std::distance(std::begin(container), std::end(container))));
+			for (auto& elem : container)
+			{
+				size_t index = range.Index(static_cast<TKey>(keyFunc(elem)));
+				buckets.offsets[index + 1]++;
+				indexed.emplace_back(index, &elem);
+			}
+			for (size_t i = 1; i < buckets.offsets.size(); i++)
+				buckets.offsets[i] += buckets.offsets[i - 1];
+
+			std::vector<size_t> cursor(buckets.offsets.begin(), buckets.offsets.end() - 1);
+			buckets.ordered.resize(indexed.size());
+			for (auto& elem : indexed)
+				buckets.ordered[cursor[elem.first]++] = elem.second;
+			return buckets;
+		}
+	}
+
+	/* GroupByDense:
+	*  GroupByCompact for keys within a DenseKeyRange: elements are bucketed by counting
+	*  key occurrences into an array indexed by key - min, so there is no sorting, hashing
+	*  or tree search. Throws std::out_of_range for keys outside the range.
+	*
+	*  Returns: a CompactGroups holding the non-empty groups in ascending key order.
+	*
+	*  Usage:
+	*  auto res = GroupByDense(events, [](const Event& e) { return e.hour; }, DenseKeyRange<int>(0, 23));
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc, typename TKey>
+	auto GroupByDense(const TContainer& container, const TGroupingMemberFunc& groupingMemberFunc, const DenseKeyRange<TKey>& range)
+	{
+		using TElement = typename RangeValue<TContainer>::type;
+		using GroupingMemberType = std::decay_t<decltype(groupingMemberFunc(*std::begin(container)))>;
+
+		auto buckets = detail::MakeDenseBuckets(container, groupingMemberFunc, range);
+		std::vector<GroupingMemberType> keys;
+		std::vector<size_t> offsets;
+		std::vector<TElement> elements;
+		elements.reserve(buckets.ordered.size());
+		for (size_t i = 0; i < range.size(); i++)
+		{
+			if (buckets.Count(i) == 0)
+				continue;
+			keys.push_back(static_cast<GroupingMemberType>(range.Key(i)));
+			offsets.push_back(elements.size());
+			for (size_t j = buckets.offsets[i]; j < buckets.offsets[i + 1]; j++)
+				elements.push_back(*buckets.ordered[j]);
+		}
+		offsets.push_back(elements.size());
+
+		return CompactGroups<GroupingMemberType, TElement>(std::move(keys), std::move(offsets), std::move(elements));
+	}
+
+	/* AggregateByDense:
+	*  AggregateBy for keys within a DenseKeyRange: accumulators live in an array indexed
+	*  by key - min. Throws std::out_of_range for keys outside the range.
+	*
+	*  Returns: the same map as AggregateBy, built in key order.
+	*
+	*  Usage:
+	*  auto res = AggregateByDense(events, [](const Event& e) { return e.hour; }, DenseKeyRange<int>(0, 23), 0,
+	*      [](int sum, const Event& e) { return sum + e.bytes; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc, typename TKey, typename TAccumulator, typename TAccumulateFunc>
+	auto AggregateByDense(TContainer&& container,
+		const TGroupingMemberFunc& groupingMemberFunc,
+		const DenseKeyRange<TKey>& range,
+		const TAccumulator& seed,
+		const TAccumulateFunc& accumulateFunc)
+	{
+		using GroupingMemberType = std::decay_t<decltype(groupingMemberFunc(*std::begin(container)))>;
+		using KeyTraits = GroupingKeyTraits<GroupingMemberType>;
+
+		std::vector<TAccumulator> accumulators(range.size(), seed);
+		std::vector<char> seen(range.size(), 0);
+		for (auto&& elem : container)
+		{
+			size_t index = range.Index(static_cast<TKey>(groupingMemberFunc(elem)));
+			accumulators[index] = accumulateFunc(std::move(accumulators[index]), elem);
+			seen[index] = 1;
+		}
+
+		std::map<typename KeyTraits::StorageType, TAccumulator, typename KeyTraits::Compare> result;
+		for (size_t i = 0; i < accumulators.size(); i++)
+		{
+			if (seen[i])
+				result.emplace_hint(result.end(), static_cast<GroupingMemberType>(range.Key(i)), std::move(accumulators[i]));
+		}
+		return result;
+	}
+
+	/* JoinDense:
+	*  Join for keys within a DenseKeyRange: both sides are bucketed into arrays indexed
+	*  by key - min and only keys present on both sides are materialized. Throws
+	*  std::out_of_range for keys outside the range.
+	*
+	*  Returns: the same map as Join, built in key order.
+	*
+	*  Usage:
+	*  auto res = JoinDense(sales, targets, [](const Sale& s) { return s.region; }, [](const Target& t) { return t.region; },
+	*      DenseKeyRange<int>(0, 255));
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer1, typename TContainer2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2, typename TKey>
+	auto JoinDense(const TContainer1& container1,
+		const TContainer2& container2,
+		const TJoiningMemberFunc1& joiningMemberFunc1,
+		const TJoiningMemberFunc2& joiningMemberFunc2,
+		const DenseKeyRange<TKey>& range)
+	{
+		using GroupingMemberType = std::decay_t<decltype(joiningMemberFunc1(*std::begin(container1)))>;
+		using KeyTraits = GroupingKeyTraits<GroupingMemberType>;
+		using Group1 = typename QueryResult<TContainer1>::type;
+		using Group2 = typename QueryResult<TContainer2>::type;
+		std::map<typename KeyTraits::StorageType, std::pair<Group1, Group2>, typename KeyTraits::Compare> result;
+
+		auto buckets1 = detail::MakeDenseBuckets(container1, joiningMemberFunc1, range);
+		auto buckets2 = detail::MakeDenseBuckets(container2, joiningMemberFunc2, range);
+		for (size_t i = 0; i < range.size(); i++)
+		{
+			if (buckets1.Count(i) == 0 || buckets2.Count(i) == 0)
+				continue;
+			auto& match = result.emplace_hint(result.end(), static_cast<GroupingMemberType>(range.Key(i)), std::pair<Group1, Group2>())->second;
+			for (size_t j = buckets1.offsets[i]; j < buckets1.offsets[i + 1]; j++)
+				detail::Append(match.first, *buckets1.ordered[j]);
+			for (size_t j = buckets2.offsets[i]; j < buckets2.offsets[i + 1]; j++)
+				detail::Append(match.second, *buckets2.ordered[j]);
+		}
+		return result;
+	}
+
+	/* OrderByKey:
+	*  Stable counting sort of a container by an integer key within a DenseKeyRange:
+	*  one counting pass and one placement pass, linear in the number of elements plus
+	*  the size of the range. Throws std::out_of_range for keys outside the range.
+	*
+	*  Usage:
+	*  OrderByKey(events, [](const Event& e) { return e.hour; }, DenseKeyRange<int>(0, 23));
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TKeyFunc, typename TKey>
+	void OrderByKey(TContainer& container, const TKeyFunc& keyFunc, const DenseKeyRange<TKey>& range)
+	{
+		using TElement = typename RangeValue<TContainer>::type;
+		auto buckets = detail::MakeDenseBuckets(container, keyFunc, range);
+		std::vector<TElement> sorted;
+		sorted.reserve(buckets.ordered.size());
+		for (auto elem : buckets.ordered)
+			sorted.push_back(std::move(const_cast<TElement&>(*elem)));
+		std::move(sorted.begin(), sorted.end(), std::begin(container));
+	}
+
+	/* CountBy:
+	*  The number of elements per key, without copying elements into groups.
+	*
+	*  Returns: a map whose key is the grouping data member and whose value is the count.
+	*
+	*  Usage:
+	*  auto res = CountBy(employees, [](const Employee& e) { return e.department; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc>
+	auto CountBy(TContainer&& container, const TGroupingMemberFunc& groupingMemberFunc)
+	{
+		return AggregateBy(std::forward<TContainer>(container), groupingMemberFunc, size_t(0), [](size_t count, const auto&) { return count + 1; });
+	}
+
+	/* CountByDense:
+	*  A histogram of integer keys within a DenseKeyRange: element i of the result is the
+	*  count of key range.Key(i). Random-access ranges are split across threads that each
+	*  fill a private histogram, summed at the end, so the threads never share a counter.
+	*  Throws std::out_of_range for keys outside the range.
+	*
+	*  Usage:
+	*  auto perHour = CountByDense(events, [](const Event& e) { return e.hour; }, DenseKeyRange<int>(0, 23));
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TKeyFunc, typename TKey>
+	std::vector<size_t> CountByDense(const TContainer& container,
+		const TKeyFunc& keyFunc,
+		const DenseKeyRange<TKey>& range,
+		size_t threads = std::thread::hardware_concurrency())
+	{
+		auto count = [&keyFunc, &range](auto first, auto last, std::vector<size_t>& histogram) {
+			for (; first != last; ++first)
+				histogram[range.Index(static_cast<TKey>(keyFunc(*first)))]++;
+		};
+
+		std::vector<size_t> histogram(range.size(), 0);
+		size_t size = static_cast<size_t>(std::distance(std::begin(container), std::end(container)));
+		// Below this many elements per thread, starting threads costs more than it saves.
+		constexpr size_t MinElementsPerThread = 1 << 16;
+		threads = (std::min)(threads, size / MinElementsPerThread);
+		if constexpr (IsRandomAccessRange<const TContainer>::value)
+		{
+			if (threads > 1)
+			{
+				std::vector<std::vector<size_t>> partials(threads - 1, std::vector<size_t>(range.size(), 0));
+				std::vector<std::exception_ptr> errors(threads - 1);
+				std::vector<std::thread> workers;
+				auto first = std::begin(container);
+				size_t chunk = size / threads;
+				for (size_t t = 0; t + 1 < threads; t++)
+				{
+					workers.emplace_back([&, t] {
+						try { count(first + t * chunk, first + (t + 1) * chunk, partials[t]); }
+						catch (...) { errors[t] = std::current_exception(); }
+					});
+				}
+				std::exception_ptr error;
+				try { count(first + (threads - 1) * chunk, std::end(container), histogram); }
+				catch (...) { error = std::current_exception(); }
+				for (auto& worker : workers)
+					worker.join();
+				for (auto& partialError : errors)
+				{
+					if (!error)
+						error = partialError;
+				}
+				if (error)
+					std::rethrow_exception(error);
+
+				for (auto& partial : partials)
+				{
+					for (size_t i = 0; i < histogram.size(); i++)
+						histogram[i] += partial[i];
+				}
+				return histogram;
+			}
+		}
+		count(std::begin(container), std::end(container), histogram);
+		return histogram;
+	}
+
+	namespace detail
+	{
+		// Erases the flagged elements, keeping the order of the others.
+		template<typename TContainer>
+		void EraseFlagged(TContainer& container, const std::vector<char>& flags)
+		{
+			size_t index = 0;
+			if constexpr (IsRandomAccessRange<TContainer>::value && !IsAssociative<TContainer>::value)
+			{
+				auto kept = std::begin(container);
+				for (auto itr = std::begin(container); itr != std::end(container); ++itr)
+				{
+					if (flags[index++])
+						continue;
+					if (kept != itr)
+						*kept = std::move(*itr);
+					++kept;
+				}
+				container.erase(kept, std::end(container));
+			}
+			else
+			{
+				for (auto itr = std::begin(container); itr != std::end(container);)
+				{
+					if (flags[index++])
+						itr = container.erase(itr);
+					else
+						++itr;
+				}
+			}
+		}
+	}
+
+	/* MergeResult:
+	*  How many target rows a Merge statement matched, inserted and deleted.
+	*/
+	struct MergeResult
+	{
+		size_t matched = 0;
+		size_t inserted = 0;
+		size_t deleted = 0;
+	};
+
+	/* Merge Statement:
+	*  Merges a batch into a container by key, like SQL MERGE: target rows whose key appears
+	*  in the source are passed to onMatch with the source row, source rows with a new key
+	*  are converted by onInsert and appended, and with deleteUnmatched the target rows no
+	*  source row matched are removed. The target's keys are hashed once, so the whole
+	*  statement is a single pass over each side instead of Join + Update + append.
+	*  Source rows that repeat a new key are merged into the row inserted for it.
+	*
+	*  Usage:
+	*  struct Stock { int sku; int count; };
+	*  vector<Stock> stock{ {1, 5}, {2, 0} };
+	*  vector<Stock> delivery{ {2, 10}, {3, 4} };
+	*  Merge(stock, delivery, [](const Stock& s) { return s.sku; },
+	*      [](Stock& row, const Stock& in) { row.count += in.count; },
+	*      [](const Stock& in) { return in; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TTarget, typename TSource, typename TKeyFunc, typename TMatchFunc, typename TInsertFunc>
+	MergeResult Merge(TTarget& target,
+		const TSource& source,
+		const TKeyFunc& keyFunc,
+		const TMatchFunc& onMatch,
+		const TInsertFunc& onInsert,
+		bool deleteUnmatched = false)
+	{
+		using TElement = typename RangeValue<TTarget>::type;
+		using KeyType = typename GroupingKeyTraits<std::decay_t<decltype(keyFunc(std::declval<const TElement&>()))>>::StorageType;
+		using TargetIterator = decltype(std::begin(target));
+		constexpr size_t NoRow = std::numeric_limits<size_t>::max();
+		struct Entry
+		{
+			size_t first;
+			size_t last;
+		};
+
+		// Target rows sharing a key are chained in their original order through next.
+		MergeResult result;
+		size_t size = static_cast<size_t>(std::distance(std::begin(target), std::end(target)));
+		std::vector<TargetIterator> rows;
+		std::vector<size_t> next;
+		FlatHashMap<KeyType, Entry> index;
+		rows.reserve(size);
+		next.reserve(size);
+		index.reserve(size);
+		for (auto itr = std::begin(target); itr != std::end(target); ++itr)
+		{
+			auto inserted = index.try_emplace(KeyType(keyFunc(*itr)), Entry{ rows.size(), rows.size() });
+			if (!inserted.second)
+			{
+				next[inserted.first->second.last] = rows.size();
+				inserted.first->second.last = rows.size();
+			}
+			rows.push_back(itr);
+			next.push_back(NoRow);
+		}
+
+		// Flags rows by position, so onMatch may change a row's key.
+		std::vector<char> unmatched(deleteUnmatched ? size : 0, 1);
+		std::deque<TElement> pending;
+		FlatHashMap<KeyType, TElement*> pendingIndex;
+		for (auto& element : source)
+		{
+			auto&& raw = keyFunc(element);
+			auto&& key = detail::ProbeKey<decltype(index)>(raw);
+			auto match = index.find(key);
+			if (match != index.end())
+			{
+				for (size_t row = match->second.first; row != NoRow; row = next[row])
+				{
+					onMatch(*rows[row], element);
+					result.matched++;
+					if (deleteUnmatched)
+						unmatched[row] = 0;
+				}
+				continue;
+			}
+
+			auto inserted = pendingIndex.find(key);
+			if (inserted != pendingIndex.end())
+			{
+				onMatch(*inserted->second, element);
+				continue;
+			}
+			pending.push_back(onInsert(element));
+			pendingIndex.try_emplace(KeyType(std::forward<decltype(key)>(key)), &pending.back());
+		}
+
+		if (deleteUnmatched)
+		{
+			detail::EraseFlagged(target, unmatched);
+			result.deleted = static_cast<size_t>(std::count(unmatched.begin(), unmatched.end(), 1));
+		}
+
+		result.inserted = pending.size();
+		if constexpr (IsAssociative<TTarget>::value)
+			target.insert(std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+		else
+			target.insert(std::end(target), std::make_move_iterator(pending.begin()), std::make_move_iterator(pending.end()));
+		return result;
+	}
+
+	namespace detail
+	{
+		// Flags, in container order, the elements whose key is in keys: a single merge walk
+		// when both sequences are sorted, probes into a hash set of the keys otherwise.
+		template<typename TContainer, typename TKeyFunc, typename TKeys>
+		std::vector<char> FlagKeysIn(const TContainer& container, const TKeyFunc& keyFunc, const TKeys& keys)
+		{
+			using TElement = typename RangeValue<TContainer>::type;
+			using KeyType = typename GroupingKeyTraits<std::decay_t<decltype(keyFunc(std::declval<const TElement&>()))>>::StorageType;
+
+			std::vector<char> flags;
+			flags.reserve(static_cast<size_t>(std::distance(std::begin(container), std::end(container))));
+			bool sorted = std::is_sorted(std::begin(keys), std::end(keys)) &&
+				std::is_sorted(std::begin(container), std::end(container), [&keyFunc](const TElement& l, const TElement& r) { return keyFunc(l) < keyFunc(r); });
+			if (sorted)
+			{
+				auto cursor = std::begin(keys);
+				for (auto& element : container)
+				{
+					auto key = keyFunc(element);
+					while (cursor != std::end(keys) && *cursor < key)
+						++cursor;
+					flags.push_back(cursor != std::end(keys) && !(key < *cursor));
+				}
+				return flags;
+			}
+
+			FlatHashSet<KeyType> set;
+			set.reserve(static_cast<size_t>(std::distance(std::begin(keys), std::end(keys))));
+			for (auto& key : keys)
+				set.insert(KeyType(key));
+			for (auto& element : container)
+				flags.push_back(set.contains(detail::ProbeKey<decltype(set)>(keyFunc(element))));
+			return flags;
+		}
+	}
+
+	/* DeleteWhereKeyIn Statement:
+	*  Removes the elements whose key is one of the given keys and returns how many were
+	*  removed. The keys are put in a hash set sized up front, or, when both the keys and
+	*  the container (by key) are already sorted, matched by a single merge walk.
+	*
+	*  Usage:
+	*  vector<Employee> employees = ...;
+	*  vector<int> leavers{ 4, 8, 15 };
+	*  DeleteWhereKeyIn(employees, [](const Employee& e) { return e.id; }, leavers);
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TKeyFunc, typename TKeys>
+	size_t DeleteWhereKeyIn(TContainer& container, const TKeyFunc& keyFunc, const TKeys& keys)
+	{
+		auto flags = detail::FlagKeysIn(container, keyFunc, keys);
+		detail::EraseFlagged(container, flags);
+		return static_cast<size_t>(std::count(flags.begin(), flags.end(), 1));
+	}
+
+	/* UpdateWhereKeyIn Statement:
+	*  Applies setFunc to the elements whose key is one of the given keys and returns how
+	*  many were updated; keys are matched as in DeleteWhereKeyIn.
+	*
+	*  Usage:
+	*  UpdateWhereKeyIn(employees, [](const Employee& e) { return e.id; }, promoted, [](Employee& e) { e.salary += 10; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TKeyFunc, typename TKeys, typename TSetFunc>
+	size_t UpdateWhereKeyIn(TContainer& container, const TKeyFunc& keyFunc, const TKeys& keys, const TSetFunc& setFunc)
+	{
+		auto flags = detail::FlagKeysIn(container, keyFunc, keys);
+		size_t index = 0;
+		for (auto& element : container)
+		{
+			if (flags[index++])
+				setFunc(element);
+		}
+		return static_cast<size_t>(std::count(flags.begin(), flags.end(), 1));
+	}
+
+	/* JoinIndices:
+	*  Join that returns positions instead of copies: a (leftIndex, rightIndex) pair for
+	*  every pair of elements of container1 and container2 with equal keys, ordered by
+	*  leftIndex and then rightIndex. The second container's keys are hashed into a
+	*  FlatHashMap and the first container probes it, so no element is copied; use
+	*  Gather to project just the fields needed from the matched elements.
+	*
+	*  Usage:
+	*  auto pairs = JoinIndices(orders, customers, [](const Order& o) { return o.customerId; }, [](const Customer& c) { return c.id; });
+	*  auto names = Gather(orders, customers, pairs, [](const Order& o, const Customer& c) { return std::make_pair(o.id, c.name); });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer1, typename TContainer2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2>
+	std::vector<std::pair<size_t, size_t>> JoinIndices(const TContainer1& container1,
+		const TContainer2& container2,
+		const TJoiningMemberFunc1& joiningMemberFunc1,
+		const TJoiningMemberFunc2& joiningMemberFunc2)
+	{
+		using GroupingMemberType = std::decay_t<decltype(joiningMemberFunc1(*std::begin(container1)))>;
+		using KeyType = typename GroupingKeyTraits<GroupingMemberType>::StorageType;
+		constexpr size_t NoRow = std::numeric_limits<size_t>::max();
+		struct Entry
+		{
+			size_t first;
+			size_t last;
+		};
+
+		// Right rows sharing a key are chained in their original order through next.
+		std::vector<size_t> next;
+		FlatHashMap<KeyType, Entry> index;
+		index.reserve(static_cast<size_t>(std::distance(std::begin(container2), std::end(container2))));
+		for (auto& element : container2)
+		{
+			size_t row = next.size();
+			auto inserted = index.try_emplace(KeyType(joiningMemberFunc2(element)), Entry{ row, row });
+			if (!inserted.second)
+			{
+				next[inserted.first->second.last] = row;
+				inserted.first->second.last = row;
+			}
+			next.push_back(NoRow);
+		}
+
+		std::vector<std::pair<size_t, size_t>> result;
+		size_t left = 0;
+		for (auto& element : container1)
+		{
+			auto match = index.find(detail::ProbeKey<decltype(index)>(joiningMemberFunc1(element)));
+			if (match != index.end())
+			{
+				for (size_t right = match->second.first; right != NoRow; right = next[right])
+					result.emplace_back(left, right);
+			}
+			left++;
+		}
+		return result;
+	}
+
+	namespace detail
+	{
+		// Positional access to any range: random-access ranges directly, others through
+		// a table of element addresses built once.
+		template<typename TContainer>
+		auto MakePositionalAccess(const TContainer& container)
+		{
+			if constexpr (IsRandomAccessRange<const TContainer>::value)
+			{
+				auto first = std::begin(container);
+				return [first](size_t index) -> decltype(*first) { return first[static_cast<std::ptrdiff_t>(index)]; };
+			}
+			else
+			{
+				std::vector<const typename RangeValue<TContainer>::type*> elements;
+				for (auto& element : container)
+					elements.push_back(std::addressof(element));
+				return [elements = std::move(elements)](size_t index) -> const typename RangeValue<TContainer>::type& { return *elements[index]; };
+			}
+		}
+	}
+
+	/* Gather:
+	*  Projects the elements at the given positions through a selector, e.g. the indices
+	*  or index pairs returned by JoinIndices, so only the selected fields are copied.
+	*
+	*  Returns: a vector of whatever the selector returns, in the order of the positions.
+	*
+	*  Usage:
+	*  auto ids = Gather(orders, std::vector<size_t>{ 4, 2 }, [](const Order& o) { return o.id; });
+	*  auto rows = Gather(orders, customers, JoinIndices(orders, customers, func1, func2),
+	*      [](const Order& o, const Customer& c) { return std::make_pair(o.id, c.name); });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TIndices, typename TSelector>
+	auto Gather(const TContainer& container, const TIndices& indices, const TSelector& selector)
+	{
+		std::vector<std::decay_t<decltype(selector(*std::begin(container)))>> result;
+		result.reserve(static_cast<size_t>(std::distance(std::begin(indices), std::end(indices))));
+		auto at = detail::MakePositionalAccess(container);
+		for (size_t index : indices)
+			result.push_back(selector(at(index)));
+		return result;
+	}
+
+	template<typename TContainer1, typename TContainer2, typename TSelector>
+	auto Gather(const TContainer1& container1,
+		const TContainer2& container2,
+		const std::vector<std::pair<size_t, size_t>>& indexPairs,
+		const TSelector& selector)
+	{
+		std::vector<std::decay_t<decltype(selector(*std::begin(container1), *std::begin(container2)))>> result;
+		result.reserve(indexPairs.size());
+		auto at1 = detail::MakePositionalAccess(container1);
+		auto at2 = detail::MakePositionalAccess(container2);
+		for (auto& indexPair : indexPairs)
+			result.push_back(selector(at1(indexPair.first), at2(indexPair.second)));
+		return result;
+	}
+
+	/* AccessPattern:
+	*  Hint passed to the OS about how a MappedTable is going to be read.
+	*/
+	enum class AccessPattern
+	{
+		Normal,
+		Sequential,
+		Random,
+		WillNeed
+	};
+
+	/* MappedTable:
+	*  A read-only table of trivially copyable records backed by a memory-mapped binary file.
+	*  Records are paged in on demand, so opening is independent of the file size.
+	*  It is a contiguous range and can be passed to every query, queries that return
+	*  elements return a std::vector.
+	*
+	*  Usage:
+	*  struct Trade { int64_t time; int32_t symbol; double price; };
+	*  MappedTable<Trade> trades("trades.bin");
+	*  auto res = GroupBy(trades, [](const Trade& t) { return t.symbol; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TRecord>
+	class MappedTable
+	{
+		static_assert(std::is_trivially_copyable<TRecord>::value, "MappedTable records must be trivially copyable");
+
+	public:
+		using value_type = TRecord;
+		using size_type = size_t;
+		using const_iterator = const TRecord*;
+		using iterator = const_iterator;
+
+		explicit MappedTable(const std::string& path, AccessPattern pattern = AccessPattern::Sequential)
+		{
+			bytes_ = Map(path, pattern);
+			if (bytes_ % sizeof(TRecord) != 0)
+			{
+				Unmap();
+				throw std::runtime_error("cql::MappedTable: size of " + path + " is not a multiple of the record size");
+			}
+			size_ = bytes_ / sizeof(TRecord);
+			Advise(pattern);
+		}
+
+		MappedTable(const MappedTable&) = delete;
+		MappedTable& operator=(const MappedTable&) = delete;
+		MappedTable(MappedTable&& other) noexcept : data_(other.data_), size_(other.size_), bytes_(other.bytes_)
+		{
+			other.data_ = nullptr;
+			other.size_ = 0;
+			other.bytes_ = 0;
+		}
+		MappedTable& operator=(MappedTable&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Unmap();
+				std::swap(data_, other.data_);
+				std::swap(size_, other.size_);
+				std::swap(bytes_, other.bytes_);
+			}
+			return *this;
+		}
+		~MappedTable() { Unmap(); }
+
+		const TRecord* data() const { return data_; }
+		size_t size() const { return size_; }
+		bool empty() const { return size_ == 0; }
+		const TRecord* begin() const { return data_; }
+		const TRecord* end() const { return data_ + size_; }
+		const TRecord& operator[](size_t index) const { return data_[index]; }
+
+#if defined(__cpp_lib_span)
+		std::span<const TRecord> span() const { return std::span<const TRecord>(data_, size_); }
+#endif
+
+		// Changes the paging hint for the whole table, a no-op where the OS has no equivalent.
+		void Advise(AccessPattern pattern) const
+		{
+#if !defined(_WIN32)
+			if (data_ == nullptr)
+				return;
+			int advice = MADV_NORMAL;
+			if (pattern == AccessPattern::Sequential)
+				advice = MADV_SEQUENTIAL;
+			else if (pattern == AccessPattern::Random)
+				advice = MADV_RANDOM;
+			else if (pattern == AccessPattern::WillNeed)
+				advice = MADV_WILLNEED;
+			madvise(const_cast<TRecord*>(data_), bytes_, advice);
+#else
+			(void)pattern;
+#endif
+		}
+
+	private:
+#if defined(_WIN32)
+		size_t Map(const std::string& path, AccessPattern pattern)
+		{
+			DWORD flags = pattern == AccessPattern::Sequential ? FILE_FLAG_SEQUENTIAL_SCAN
+				: pattern == AccessPattern::Random ? FILE_FLAG_RANDOM_ACCESS : FILE_ATTRIBUTE_NORMAL;
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, flags, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "cql::MappedTable: cannot open " + path);
+			LARGE_INTEGER fileSize{};
+			if (!GetFileSizeEx(file, &fileSize))
+			{
+				auto error = GetLastError();
+				CloseHandle(file);
+				throw std::system_error(static_cast<int>(error), std::system_category(), "cql::MappedTable: cannot stat " + path);
+			}
+			if (fileSize.QuadPart == 0)
+			{
+				CloseHandle(file);
+				return 0;
+			}
+			HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+			auto error = GetLastError();
+			if (mapping != nullptr)
+				CloseHandle(mapping);
+			CloseHandle(file);
+			if (view == nullptr)
+				throw std::system_error(static_cast<int>(error), std::system_category(), "cql::MappedTable: cannot map " + path);
+			data_ = static_cast<const TRecord*>(view);
+			return static_cast<size_t>(fileSize.QuadPart);
+		}
+
+		void Unmap()
+		{
+			if (data_ != nullptr)
+				UnmapViewOfFile(data_);
+			data_ = nullptr;
+			size_ = 0;
+			bytes_ = 0;
+		}
+#else
+		size_t Map(const std::string& path, AccessPattern)
+		{
+			int file = open(path.c_str(), O_RDONLY);
+			if (file < 0)
+				throw std::system_error(errno, std::generic_category(), "cql::MappedTable: cannot open " + path);
+			struct stat status {};
+			if (fstat(file, &status) != 0)
+			{
+				int error = errno;
+				close(file);
+				throw std::system_error(error, std::generic_category(), "cql::MappedTable: cannot stat " + path);
+			}
+			size_t bytes = static_cast<size_t>(status.st_size);
+			if (bytes == 0)
+			{
+				close(file);
+				return 0;
+			}
+			void* view = mmap(nullptr, bytes, PROT_READ, MAP_SHARED, file, 0);
+			int error = errno;
+			close(file);
+			if (view == MAP_FAILED)
+				throw std::system_error(error, std::generic_category(), "cql::MappedTable: cannot map " + path);
+			data_ = static_cast<const TRecord*>(view);
+			return bytes;
+		}
+
+		void Unmap()
+		{
+			if (data_ != nullptr)
+				munmap(const_cast<TRecord*>(data_), bytes_);
+			data_ = nullptr;
+			size_ = 0;
+			bytes_ = 0;
+		}
+#endif
+
+		const TRecord* data_ = nullptr;
+		size_t size_ = 0;
+		size_t bytes_ = 0;
+	};
+
+	/* SaveTable:
+	*  Writes the records of a range to a binary file readable by MappedTable.
+	*
+	*  Usage:
+	*  vector<Trade> trades = ...;
+	*  SaveTable("trades.bin", trades);
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer>
+	void SaveTable(const std::string& path, const TContainer& container)
+	{
+		using TRecord = typename RangeValue<TContainer>::type;
+		static_assert(std::is_trivially_copyable<TRecord>::value, "SaveTable records must be trivially copyable");
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+		if (!file)
+			throw std::runtime_error("cql::SaveTable: cannot open " + path);
+		for (auto& record : container)
+		{
+			file.write(reinterpret_cast<const char*>(&record), sizeof(TRecord));
+		}
+		if (!file)
+			throw std::runtime_error("cql::SaveTable: cannot write " + path);
+	}
+
+	/* DelimitedRow:
+	*  One parsed row of a DelimitedReader. Fields are views into the reader's buffer
+	*  and are valid until the reader advances.
+	*/
+	class DelimitedRow
+	{
+	public:
+		size_t size() const { return fields_.size(); }
+		bool empty() const { return fields_.empty(); }
+		std::string_view operator[](size_t index) const { return fields_[index]; }
+		std::vector<std::string_view>::const_iterator begin() const { return fields_.begin(); }
+		std::vector<std::string_view>::const_iterator end() const { return fields_.end(); }
+
+		// Converts a field to a number (std::from_chars), std::string or std::string_view.
+		template<typename T>
+		T As(size_t index) const
+		{
+			std::string_view field = fields_.at(index);
+			if constexpr (std::is_same<T, std::string_view>::value)
+			{
+				return field;
+			}
+			else if constexpr (std::is_same<T, std::string>::value)
+			{
+				return std::string(field);
+			}
+			else
+			{
+				T value{};
+				auto parsed = std::from_chars(field.data(), field.data() + field.size(), value);
+				if (parsed.ec != std::errc() || parsed.ptr != field.data() + field.size())
+					throw std::invalid_argument("cql::DelimitedRow: cannot convert field '" + std::string(field) + "'");
+				return value;
+			}
+		}
+
+	private:
+		friend class DelimitedReader;
+		std::vector<std::string_view> fields_;
+	};
+
+	/* DelimitedReader:
+	*  A streaming reader of delimited text (CSV, TSV, ...) that parses one row at a time
+	*  from a bounded buffer. It is a single-pass input range of DelimitedRow, so it can be
+	*  fed into WhereView and AggregateBy to filter and aggregate while parsing.
+	*  Fields may be quoted with '"' (a doubled quote inside is an escaped quote), quoted
+	*  fields cannot span lines. Empty lines are skipped.
+	*  Rows hold views into the reader's buffer: convert fields to owned values before
+	*  advancing, e.g. with DelimitedRow::As.
+	*
+	*  Usage:
+	*  DelimitedReader reader("access.csv");
+	*  reader.Skip(1);  // header
+	*  auto errors = WhereView(reader, [](const DelimitedRow& row) { return row[2] == "500"; });
+	*  auto res = AggregateBy(errors, [](const DelimitedRow& row) { return row[0]; }, 0,
+	*      [](int count, const DelimitedRow&) { return count + 1; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	class DelimitedReader
+	{
+	public:
+		class iterator
+		{
+		public:
+			using iterator_category = std::input_iterator_tag;
+			using value_type = DelimitedRow;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const DelimitedRow*;
+			using reference = const DelimitedRow&;
+
+			iterator() = default;
+			explicit iterator(DelimitedReader* reader) : reader_(reader)
+			{
+				if (!reader_->hasRow_)
+					reader_->Next();
+			}
+
+			reference operator*() const { return reader_->row_; }
+			pointer operator->() const { return &reader_->row_; }
+			iterator& operator++() { reader_->Next(); return *this; }
+			void operator++(int) { reader_->Next(); }
+			bool operator==(const iterator& other) const { return AtEnd() == other.AtEnd(); }
+			bool operator!=(const iterator& other) const { return AtEnd() != other.AtEnd(); }
+
+		private:
+			bool AtEnd() const { return reader_ == nullptr || !reader_->hasRow_; }
+
+			DelimitedReader* reader_ = nullptr;
+		};
+
+		explicit DelimitedReader(std::istream& input, char delimiter = ',', size_t bufferSize = 64 * 1024)
+			: input_(&input), delimiter_(delimiter), buffer_((std::max)(bufferSize, size_t(16))) {}
+
+		explicit DelimitedReader(const std::string& path, char delimiter = ',', size_t bufferSize = 64 * 1024)
+			: ownedInput_(std::make_unique<std::ifstream>(path, std::ios::binary)), 
+			delimiter_(delimiter), 
+			buffer_((std::max)(bufferSize, size_t(16)))
+		{
+			if (!*ownedInput_)
+				throw std::runtime_error("cql::DelimitedReader: cannot open " + path);
+			input_ = ownedInput_.get();
+		}
+
+		DelimitedReader(const DelimitedReader&) = delete;
+		DelimitedReader& operator=(const DelimitedReader&) = delete;
+
+		// Parses the next row, returns false when the input is exhausted.
+		bool Next()
+		{
+			hasRow_ = false;
+			row_.fields_.clear();
+			while (true)
+			{
+				const char* lineEnd = nullptr;
+				size_t scanned = 0;
+				while (true)
+				{
+					lineEnd = static_cast<const char*>(std::memchr(buffer_.data() + position_ + scanned, '\n', end_ - position_ - scanned));
+					if (lineEnd != nullptr || eof_)
+						break;
+					scanned = end_ - position_;
+					Refill();
+				}
+				if (position_ == end_)
+					return false;
+
+				char* line = buffer_.data() + position_;
+				size_t lineLength = lineEnd != nullptr ? static_cast<size_t>(lineEnd - line) : end_ - position_;
+				position_ += lineLength + (lineEnd != nullptr ? 1 : 0);
+				if (lineLength > 0 && line[lineLength - 1] == '\r')
+					lineLength--;
+				if (lineLength == 0)
+					continue;
+
+				Split(line, lineLength);
+				hasRow_ = true;
+				return true;
+			}
+		}
+
+		// Consumes rows without exposing them, e.g. a header line.
+		void Skip(size_t rows)
+		{
+			for (size_t i = 0; i < rows && Next(); i++) {}
+			hasRow_ = false;
+		}
+
+		const DelimitedRow& Row() const { return row_; }
+
+		iterator begin() { return iterator(this); }
+		iterator end() { return iterator(); }
+
+	private:
+		// Moves the unread bytes to the front and reads more input, growing the buffer
+		// only when a single line does not fit.
+		void Refill()
+		{
+			size_t unread = end_ - position_;
+			if (position_ > 0)
+				std::memmove(buffer_.data(), buffer_.data() + position_, unread);
+			position_ = 0;
+			end_ = unread;
+			if (end_ == buffer_.size())
+				buffer_.resize(buffer_.size() * 2);
+			input_->read(buffer_.data() + end_, static_cast<std::streamsize>(buffer_.size() - end_));
+			end_ += static_cast<size_t>(input_->gcount());
+			if (!*input_)
+				eof_ = true;
+		}
+
+		void Split(char* cursor, size_t length)
+		{
+			char* last = cursor + length;
+			while (true)
+			{
+				if (cursor != last && *cursor == '"')
+				{
+					cursor = SplitQuoted(cursor, last);
+					if (cursor == nullptr)
+						return;
+					continue;
+				}
+				char* next = static_cast<char*>(std::memchr(cursor, delimiter_, static_cast<size_t>(last - cursor)));
+				if (next == nullptr)
+				{
+					row_.fields_.emplace_back(cursor, static_cast<size_t>(last - cursor));
+					return;
+				}
+				row_.fields_.emplace_back(cursor, static_cast<size_t>(next - cursor));
+				cursor = next + 1;
+			}
+		}
+
+		// Unescapes a quoted field in place and returns the start of the next field,
+		// or nullptr when it was the last one.
+		char* SplitQuoted(char* first, char* last)
+		{
+			char* write = first;
+			char* read = first + 1;
+			while (true)
+			{
+				char* quote = static_cast<char*>(std::memchr(read, '"', static_cast<size_t>(last - read)));
+				char* segmentEnd = quote != nullptr ? quote : last;
+				std::memmove(write, read, static_cast<size_t>(segmentEnd - read));
+				write += segmentEnd - read;
+				if (quote != nullptr && quote + 1 != last && quote[1] == '"')
+				{
+					*write++ = '"';
+					read = quote + 2;
+					continue;
+				}
+				row_.fields_.emplace_back(first, static_cast<size_t>(write - first));
+				if (quote == nullptr)
+					return nullptr;
+				char* next = static_cast<char*>(std::memchr(quote + 1, delimiter_, static_cast<size_t>(last - quote - 1)));
+				return next != nullptr ? next + 1 : nullptr;
+			}
+		}
+
+		std::unique_ptr<std::ifstream> ownedInput_;
+		std::istream* input_ = nullptr;
+		char delimiter_;
+		std::vector<char> buffer_;
+		size_t position_ = 0;
+		size_t end_ = 0;
+		bool eof_ = false;
+		bool hasRow_ = false;
+		DelimitedRow row_;
+	};
+
+	template <typename Type>
+	struct IsPair : public std::false_type {};
+	template <typename T1, typename T2>
+	struct IsPair<std::pair<T1, T2>> : public std::true_type {};
+
+	template <typename Type>
+	struct IsGroupView : public std::false_type {};
+	template <typename TElement>
+	struct IsGroupView<GroupView<TElement>> : public std::true_type {};
+
+	template <typename Type>
+	struct IsCompactGroups : public std::false_type {};
+	template <typename TKey, typename TElement>
+	struct IsCompactGroups<CompactGroups<TKey, TElement>> : public std::true_type {};
+
+	template <typename Type, typename = void>
+	struct IsMapLike : public std::false_type {};
+	template <typename Type>
+	struct IsMapLike<Type, typename MakeVoid<typename Type::key_type, typename Type::mapped_type>::type> : public std::true_type {};
+
+	template <typename Type, typename = void>
+	struct IsSequenceLike : public std::false_type {};
+	template <typename Type>
+	struct IsSequenceLike<Type, typename MakeVoid<typename Type::value_type, decltype(std::declval<Type&>().insert(std::declval<Type&>().end(), std::declval<typename Type::value_type>()))>::type> : public std::true_type {};
+
+	/* BinaryWriter:
+	*  Serializes query results into a flat byte buffer: trivially copyable values are
+	*  written as aligned raw bytes, strings and containers (including GroupBy/Join maps
+	*  and CompactGroups) as a 64-bit length followed by their elements. Containers of
+	*  trivially copyable elements are written as one contiguous block, so a BinaryReader
+	*  can expose them without copying.
+	*  The format is the in-memory layout of the writing process; it is meant for
+	*  processes built with the same compiler on the same architecture.
+	*/
+	class BinaryWriter
+	{
+	public:
+		template<typename T>
+		void Write(const T& value)
+		{
+			if constexpr (std::is_same<T, std::string>::value || std::is_same<T, std::string_view>::value)
+			{
+				WriteSize(value.size());
+				WriteBytes(value.data(), value.size());
+			}
+			else if constexpr (IsPair<T>::value)
+			{
+				Write(value.first);
+				Write(value.second);
+			}
+			else if constexpr (IsCompactGroups<T>::value)
+			{
+				Write(value.Keys());
+				Write(value.Offsets());
+				Write(value.Elements());
+			}
+			else if constexpr (std::is_trivially_copyable<T>::value && !IsGroupView<T>::value)
+			{
+				Align(alignof(T));
+				WriteBytes(&value, sizeof(T));
+			}
+			else
+			{
+				using TElement = typename RangeValue<T>::type;
+				WriteSize(static_cast<size_t>(std::distance(std::begin(value), std::end(value))));
+				if constexpr (std::is_trivially_copyable<TElement>::value && IsContiguousRange<const T>::value)
+				{
+					Align(alignof(TElement));
+					WriteBytes(std::data(value), sizeof(TElement) * std::size(value));
+				}
+				else
+				{
+					for (auto& element : value)
+					{
+						Write(element);
+					}
+				}
+			}
+		}
+
+		const std::vector<char>& Buffer() const { return buffer_; }
+		std::vector<char> Release() { return std::move(buffer_); }
+
+	private:
+		void WriteSize(size_t size)
+		{
+			uint64_t size64 = size;
+			Align(alignof(uint64_t));
+			WriteBytes(&size64, sizeof(size64));
+		}
+
+		void WriteBytes(const void* data, size_t size)
+		{
+			const char* bytes = static_cast<const char*>(data);
+			buffer_.insert(buffer_.end(), bytes, bytes + size);
+		}
+
+		void Align(size_t alignment)
+		{
+			buffer_.resize((buffer_.size() + alignment - 1) / alignment * alignment);
+		}
+
+		std::vector<char> buffer_;
+	};
+
+	/* BinaryReader:
+	*  Reads values written by BinaryWriter. Reading a GroupView<T> (directly or as the
+	*  value type of a map) returns a view into the buffer instead of a copy, which
+	*  requires the buffer to be aligned like T and to outlive the views.
+	*  Throws std::out_of_range on truncated input.
+	*/
+	class BinaryReader
+	{
+	public:
+		BinaryReader(const char* data, size_t size) : data_(data), size_(size) {}
+		explicit BinaryReader(const std::vector<char>& buffer) : data_(buffer.data()), size_(buffer.size()) {}
+
+		template<typename T>
+		T Read()
+		{
+			if constexpr (std::is_same<T, std::string>::value)
+			{
+				size_t size = ReadSize();
+				return std::string(Take(size, 1), size);
+			}
+			else if constexpr (std::is_same<T, std::string_view>::value)
+			{
+				size_t size = ReadSize();
+				return std::string_view(Take(size, 1), size);
+			}
+			else if constexpr (IsPair<T>::value)
+			{
+				auto first = Read<std::remove_const_t<typename T::first_type>>();
+				auto second = Read<typename T::second_type>();
+				return T(std::move(first), std::move(second));
+			}
+			else if constexpr (IsGroupView<T>::value)
+			{
+				using TElement = std::remove_const_t<std::remove_reference_t<decltype(*std::declval<T>().begin())>>;
+				size_t size = ReadSize();
+				const TElement* first = reinterpret_cast<const TElement*>(TakeArray<TElement>(size));
+				if (reinterpret_cast<uintptr_t>(first) % alignof(TElement) != 0)
+					throw std::runtime_error("cql::BinaryReader: buffer is not aligned for a zero-copy view");
+				return T(first, first + size);
+			}
+			else if constexpr (IsCompactGroups<T>::value)
+			{
+				using TKey = std::decay_t<decltype(std::declval<T>().Key(0))>;
+				using TElement = typename std::decay_t<decltype(std::declval<T>().Elements())>::value_type;
+				auto keys = Read<std::vector<TKey>>();
+				auto offsets = Read<std::vector<size_t>>();
+				auto elements = Read<std::vector<TElement>>();
+				return T(std::move(keys), std::move(offsets), std::move(elements));
+			}
+			else if constexpr (std::is_trivially_copyable<T>::value)
+			{
+				T value;
+				std::memcpy(&value, Take(sizeof(T), alignof(T)), sizeof(T));
+				return value;
+			}
+			else if constexpr (IsMapLike<T>::value)
+			{
+				T result;
+				size_t size = ReadSize();
+				for (size_t i = 0; i < size; i++)
+				{
+					auto key = Read<typename T::key_type>();
+					auto mapped = Read<typename T::mapped_type>();
+					result.emplace_hint(result.end(), std::move(key), std::move(mapped));
+				}
+				return result;
+			}
+			else
+			{
+				static_assert(IsSequenceLike<T>::value, "cql::BinaryReader: unsupported type");
+				using TElement = typename T::value_type;
+				T result;
+				size_t size = ReadSize();
+				if constexpr (std::is_trivially_copyable<TElement>::value && IsContiguousRange<T>::value && HasPushBack<T>::value)
+				{
+					const char* bytes = TakeArray<TElement>(size);
+					result.resize(size);
+					if (size > 0)
+						std::memcpy(result.data(), bytes, size * sizeof(TElement));
+				}
+				else
+				{
+					for (size_t i = 0; i < size; i++)
+					{
+						result.insert(result.end(), Read<TElement>());
+					}
+				}
+				return result;
+			}
+		}
+
+		size_t Remaining() const { return size_ - position_; }
+
+	private:
+		size_t ReadSize()
+		{
+			uint64_t size64;
+			std::memcpy(&size64, Take(sizeof(size64), alignof(uint64_t)), sizeof(size64));
+			return static_cast<size_t>(size64);
+		}
+
+		const char* Take(size_t size, size_t alignment)
+		{
+			size_t start = (position_ + alignment - 1) / alignment * alignment;
+			if (start > size_ || size > size_ - start)
+				throw std::out_of_range("cql::BinaryReader: unexpected end of buffer");
+			position_ = start + size;
+			return data_ + start;
+		}
+
+		template<typename TElement>
+		const char* TakeArray(size_t size)
+		{
+			if (size > Remaining() / sizeof(TElement))
+				throw std::out_of_range("cql::BinaryReader: unexpected end of buffer");
+			return Take(size * sizeof(TElement), alignof(TElement));
+		}
+
+		const char* data_;
+		size_t size_;
+		size_t position_ = 0;
+	};
+
+	/* Serialize / Deserialize:
+	*  Convenience wrappers around BinaryWriter and BinaryReader for a single value.
+	*
+	*  Usage:
+	*  auto groups = GroupBy(shard, [](const Trade& t) { return t.symbol; });
+	*  std::vector<char> bytes = Serialize(groups);
+	*  auto copy = Deserialize<decltype(groups)>(bytes);
+	*  auto views = Deserialize<std::map<int32_t, GroupView<Trade>>>(bytes);  // no element copies
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename T>
+	std::vector<char> Serialize(const T& value)
+	{
+		BinaryWriter writer;
+		writer.Write(value);
+		return writer.Release();
+	}
+
+	template<typename T>
+	T Deserialize(const char* data, size_t size)
+	{
+		BinaryReader reader(data, size);
+		return reader.Read<T>();
+	}
+
+	template<typename T>
+	T Deserialize(const std::vector<char>& buffer)
+	{
+		return Deserialize<T>(buffer.data(), buffer.size());
+	}
+
+	/* MergeGroups:
+	*  Merges partial GroupBy/Join/AggregateBy results, e.g. computed on different shards.
+	*  Without a combining function groups with the same key are concatenated (the mapped
+	*  values must be containers, or pairs of containers for Join results); with one the
+	*  target value becomes combine(targetValue, sourceValue).
+	*
+	*  Usage:
+	*  auto total = GroupBy(shard1, func);
+	*  MergeGroups(total, GroupBy(shard2, func));
+	*  auto sums = AggregateBy(shard1, key, 0, add);
+	*  MergeGroups(sums, AggregateBy(shard2, key, 0, add), [](int l, int r) { return l + r; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TMap, typename TSourceMap, typename TCombineFunc>
+	void MergeGroups(TMap& target, TSourceMap&& source, const TCombineFunc& combineFunc)
+	{
+		for (auto& elem : source)
+		{
+			auto itr = target.lower_bound(elem.first);
+			if (itr == target.end() || target.key_comp()(elem.first, itr->first))
+			{
+				if constexpr (std::is_lvalue_reference<TSourceMap>::value)
+					target.emplace_hint(itr, elem.first, elem.second);
+				else
+					target.emplace_hint(itr, elem.first, std::move(elem.second));
+			}
+			else
+				itr->second = combineFunc(std::move(itr->second), elem.second);
+		}
+	}
+
+	template<typename TMap, typename TSourceMap>
+	void MergeGroups(TMap& target, TSourceMap&& source)
+	{
+		auto append = [](auto& to, const auto& from) { detail::AppendRange(to, from); };
+		MergeGroups(target, std::forward<TSourceMap>(source), [&append](auto left, const auto& right)
+		{
+			if constexpr (IsPair<std::decay_t<decltype(right)>>::value)
+			{
+				append(left.first, right.first);
+				append(left.second, right.second);
+			}
+			else
+			{
+				append(left, right);
+			}
+			return left;
+		});
+	}
+
+	/* IteratorRange:
+	*  A non-owning [begin, end) slice of another range.
+	*/
+	template<typename TIterator>
+	class IteratorRange
+	{
+	public:
+		using value_type = typename std::iterator_traits<TIterator>::value_type;
+		using iterator = TIterator;
+		using const_iterator = TIterator;
+
+		IteratorRange(TIterator first, TIterator last) : first_(first), last_(last) {}
+
+		TIterator begin() const { return first_; }
+		TIterator end() const { return last_; }
+		size_t size() const { return static_cast<size_t>(std::distance(first_, last_)); }
+		bool empty() const { return first_ == last_; }
+
+	private:
+		TIterator first_;
+		TIterator last_;
+	};
+
+#if !defined(_WIN32)
+	namespace detail
+	{
+		inline void WriteAll(int fd, const char* data, size_t size)
+		{
+#if defined(MSG_NOSIGNAL)
+			const int flags = MSG_NOSIGNAL;
+#else
+			const int flags = 0;
+#endif
+			while (size > 0)
+			{
+				ssize_t written = ::send(fd, data, size, flags);
+				if (written < 0 && errno == EINTR)
+					continue;
+				if (written <= 0)
+					throw std::system_error(errno, std::generic_category(), "cql: cannot write to worker socket");
+				data += written;
+				size -= static_cast<size_t>(written);
+			}
+		}
+
+		inline bool ReadAll(int fd, char* data, size_t size)
+		{
+			while (size > 0)
+			{
+				ssize_t received = ::read(fd, data, size);
+				if (received < 0 && errno == EINTR)
+					continue;
+				if (received <= 0)
+					return false;
+				data += received;
+				size -= static_cast<size_t>(received);
+			}
+			return true;
+		}
+
+		// Reads the thread count from /proc/self/stat; where it is not available the
+		// caller is trusted to uphold the single-threaded rule.
+		inline bool IsSingleThreaded()
+		{
+#if defined(__linux__)
+			std::ifstream stat("/proc/self/stat");
+			std::string line;
+			if (!std::getline(stat, line))
+				return true;
+			size_t position = line.rfind(')');
+			if (position == std::string::npos)
+				return true;
+			std::istringstream fields(line.substr(position + 1));
+			std::string field;
+			for (int i = 3; i < 20 && fields >> field; i++)
+			{
+			}
+			long threads = 0;
+			return !(fields >> threads) || threads <= 1;
+#else
+			return true;
+#endif
+		}
+
+		struct MergeShardResults
+		{
+			template<typename TResult>
+			void operator()(TResult& total, TResult&& partial) const
+			{
+				if constexpr (IsMapLike<TResult>::value)
+					MergeGroups(total, std::move(partial));
+				else
+					AppendRange(total, partial);
+			}
+		};
+	}
+
+	/* ShardPool:
+	*  Runs queries over a table split into shards, each shard loaded and owned by its own
+	*  long-lived worker process. The loader is called inside each worker with the shard
+	*  index and count, so the calling process never holds the whole table. ScatterGather
+	*  sends a query to every worker over a Unix socket, each worker replies with its
+	*  partial result serialized with BinaryWriter, and the partial results are merged in
+	*  the calling process. Without a merge function partial results are merged with
+	*  MergeGroups (maps) or concatenated.
+	*  Queries must be captureless lambdas or plain functions: they are sent to the
+	*  workers as function pointers, which stay valid because the workers are forked from
+	*  this process. Runtime parameters are passed as a serializable argument instead.
+	*  Fork safety: workers are forked once, in the constructor, which throws
+	*  std::logic_error unless the process is single-threaded at that point (create the
+	*  pool at startup, before RunAsync or any other thread is started). A forked child of
+	*  a multithreaded process may only call async-signal-safe functions, and the loader
+	*  and queries are not restricted to those.
+	*  Throws std::runtime_error if a loader or a query fails in a worker.
+	*
+	*  Usage:
+	*  auto pool = MakeShardPool(4, [](size_t shard, size_t shards) { return LoadTrades(shard, shards); });
+	*  auto res = pool.ScatterGather([](const std::vector<Trade>& shard, const double& minPrice) {
+	*      return AggregateBy(Where(shard, [&](const Trade& t) { return t.price >= minPrice; }),
+	*          [](const Trade& t) { return t.symbol; }, 0.0,
+	*          [](double sum, const Trade& t) { return sum + t.price; });
+	*  }, 10.0, [](auto& total, auto&& partial) { MergeGroups(total, partial, std::plus<double>()); });
+	*
+	*  Minimum C++ standard: C++17, POSIX only.
+	*/
+	template<typename TShard>
+	class ShardPool
+	{
+	public:
+		template<typename TLoader>
+		ShardPool(size_t shards, const TLoader& loader)
+		{
+			if (!detail::IsSingleThreaded())
+				throw std::logic_error("cql::ShardPool: workers can only be started while the process is single-threaded");
+			shards = (std::max)(shards, size_t(1));
+			for (size_t shard = 0; shard < shards; shard++)
+			{
+				int pair[2];
+				if (::socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0)
+				{
+					int error = errno;
+					Stop();
+					throw std::system_error(error, std::generic_category(), "cql::ShardPool: cannot create socket");
+				}
+				pid_t worker = ::fork();
+				if (worker == 0)
+				{
+					::close(pair[0]);
+					for (int socket : sockets_)
+						::close(socket);
+					Serve(pair[1], [&]() { return TShard(loader(shard, shards)); });
+					::_exit(0);
+				}
+				::close(pair[1]);
+				if (worker < 0)
+				{
+					int error = errno;
+					::close(pair[0]);
+					Stop();
+					throw std::system_error(error, std::generic_category(), "cql::ShardPool: cannot start worker");
+				}
+				workers_.push_back(worker);
+				sockets_.push_back(pair[0]);
+			}
+
+			bool loaded = true;
+			for (int socket : sockets_)
+			{
+				char status = 1;
+				loaded = detail::ReadAll(socket, &status, 1) && status == 0 && loaded;
+			}
+			if (!loaded)
+			{
+				Stop();
+				throw std::runtime_error("cql::ShardPool: a worker failed to load its shard");
+			}
+		}
+
+		ShardPool(const ShardPool&) = delete;
+		ShardPool& operator=(const ShardPool&) = delete;
+
+		~ShardPool()
+		{
+			Stop();
+		}
+
+		size_t size() const { return workers_.size(); }
+
+		template<typename TQuery>
+		auto ScatterGather(const TQuery& query) const
+		{
+			return ScatterGather(query, detail::MergeShardResults());
+		}
+
+		template<typename TQuery, typename TMergeFunc>
+		auto ScatterGather(const TQuery& query, const TMergeFunc& mergeFunc) const
+		{
+			using TResult = std::decay_t<decltype(query(std::declval<const TShard&>()))>;
+			static_assert(std::is_convertible<TQuery, TResult(*)(const TShard&)>::value, "cql::ShardPool: queries must be captureless");
+			TResult(*pointer)(const TShard&) = query;
+			return Run<TResult>(&Invoke<TResult>, reinterpret_cast<void(*)()>(pointer), std::vector<char>(), mergeFunc);
+		}
+
+		template<typename TQuery, typename TArgument, typename TMergeFunc>
+		auto ScatterGather(const TQuery& query, const TArgument& argument, const TMergeFunc& mergeFunc) const
+		{
+			using TResult = std::decay_t<decltype(query(std::declval<const TShard&>(), argument))>;
+			static_assert(std::is_convertible<TQuery, TResult(*)(const TShard&, const TArgument&)>::value, "cql::ShardPool: queries must be captureless");
+			TResult(*pointer)(const TShard&, const TArgument&) = query;
+			return Run<TResult>(&InvokeWith<TResult, TArgument>, reinterpret_cast<void(*)()>(pointer), Serialize(argument), mergeFunc);
+		}
+
+	private:
+		using Invoker = std::vector<char>(*)(const TShard&, void(*)(), const std::vector<char>&);
+
+		struct Request
+		{
+			Invoker invoke;
+			void(*query)();
+			uint64_t argumentSize;
+		};
+
+		template<typename TResult>
+		static std::vector<char> Invoke(const TShard& shard, void(*query)(), const std::vector<char>&)
+		{
+			return Serialize(reinterpret_cast<TResult(*)(const TShard&)>(query)(shard));
+		}
+
+		template<typename TResult, typename TArgument>
+		static std::vector<char> InvokeWith(const TShard& shard, void(*query)(), const std::vector<char>& argument)
+		{
+			return Serialize(reinterpret_cast<TResult(*)(const TShard&, const TArgument&)>(query)(shard, Deserialize<TArgument>(argument)));
+		}
+
+		template<typename TLoad>
+		static void Serve(int socket, const TLoad& load)
+		{
+			try
+			{
+				char status = 1;
+				std::optional<TShard> shard;
+				try
+				{
+					shard.emplace(load());
+					status = 0;
+				}
+				catch (...)
+				{
+				}
+				detail::WriteAll(socket, &status, 1);
+				if (!shard)
+					return;
+
+				Request request;
+				while (detail::ReadAll(socket, reinterpret_cast<char*>(&request), sizeof(request)))
+				{
+					std::vector<char> argument(static_cast<size_t>(request.argumentSize));
+					if (!detail::ReadAll(socket, argument.data(), argument.size()))
+						return;
+					std::vector<char> reply;
+					status = 0;
+					try
+					{
+						reply = request.invoke(*shard, request.query, argument);
+					}
+					catch (...)
+					{
+						status = 1;
+						reply.clear();
+					}
+					uint64_t length = reply.size();
+					detail::WriteAll(socket, &status, 1);
+					detail::WriteAll(socket, reinterpret_cast<const char*>(&length), sizeof(length));
+					detail::WriteAll(socket, reply.data(), reply.size());
+				}
+			}
+			catch (...)
+			{
+			}
+		}
+
+		template<typename TResult, typename TMergeFunc>
+		TResult Run(Invoker invoke, void(*query)(), const std::vector<char>& argument, const TMergeFunc& mergeFunc) const
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (broken_)
+				throw std::runtime_error("cql::ShardPool: a worker failed");
+
+			Request request{ invoke, query, argument.size() };
+			try
+			{
+				for (int socket : sockets_)
+				{
+					detail::WriteAll(socket, reinterpret_cast<const char*>(&request), sizeof(request));
+					detail::WriteAll(socket, argument.data(), argument.size());
+				}
+			}
+			catch (const std::system_error&)
+			{
+				broken_ = true;
+				throw std::runtime_error("cql::ShardPool: a worker failed");
+			}
+
+			TResult result{};
+			bool failed = false;
+			for (size_t shard = 0; shard < sockets_.size(); shard++)
+			{
+				char status = 1;
+				uint64_t length = 0;
+				std::vector<char> bytes;
+				if (!detail::ReadAll(sockets_[shard], &status, 1) ||
+					!detail::ReadAll(sockets_[shard], reinterpret_cast<char*>(&length), sizeof(length)))
+				{
+					broken_ = true;
+					break;
+				}
+				bytes.resize(static_cast<size_t>(length));
+				if (!detail::ReadAll(sockets_[shard], bytes.data(), bytes.size()))
+				{
+					broken_ = true;
+					break;
+				}
+				failed = failed || status != 0;
+				if (failed)
+					continue;
+				if (shard == 0)
+					result = Deserialize<TResult>(bytes);
+				else
+					mergeFunc(result, Deserialize<TResult>(bytes));
+			}
+			if (failed || broken_)
+				throw std::runtime_error("cql::ShardPool: a worker failed");
+			return result;
+		}
+
+		void Stop()
+		{
+			for (int socket : sockets_)
+				::close(socket);
+			for (pid_t worker : workers_)
+			{
+				int status = 0;
+				while (::waitpid(worker, &status, 0) < 0 && errno == EINTR)
+				{
+				}
+			}
+			sockets_.clear();
+			workers_.clear();
+		}
+
+		std::vector<pid_t> workers_;
+		std::vector<int> sockets_;
+		mutable std::mutex mutex_;
+		mutable bool broken_ = false;
+	};
+
+	template<typename TLoader>
+	auto MakeShardPool(size_t shards, const TLoader& loader)
+	{
+		using TShard = std::decay_t<decltype(loader(size_t(0), size_t(1)))>;
+		return ShardPool<TShard>(shards, loader);
+	}
+#endif
+
+	/* OffsetPtr:
+	*  A pointer stored as the distance from its own address, so it stays valid when the
+	*  memory holding it is mapped at different addresses, e.g. in shared memory.
+	*/
+	template<typename T>
+	class OffsetPtr
+	{
+	public:
+		OffsetPtr() = default;
+		OffsetPtr(T* pointer) { Set(pointer); }
+		OffsetPtr(const OffsetPtr& other) { Set(other.get()); }
+		OffsetPtr& operator=(const OffsetPtr& other) { Set(other.get()); return *this; }
+		OffsetPtr& operator=(T* pointer) { Set(pointer); return *this; }
+
+		T* get() const
+		{
+			if (offset_ == 0)
+				return nullptr;
+			return reinterpret_cast<T*>(reinterpret_cast<intptr_t>(this) + offset_);
+		}
+		T* operator->() const { return get(); }
+		T& operator*() const { return *get(); }
+		T& operator[](size_t index) const { return get()[index]; }
+		explicit operator bool() const { return offset_ != 0; }
+
+	private:
+		void Set(T* pointer)
+		{
+			offset_ = pointer == nullptr ? 0 : reinterpret_cast<intptr_t>(pointer) - reinterpret_cast<intptr_t>(this);
+		}
+
+		intptr_t offset_ = 0;
+	};
+
+	/* SharedMemorySegment:
+	*  A named shared memory segment (POSIX shm_open / Windows named file mapping) with a
+	*  lock-free bump allocator and a small directory of named objects. Objects placed in
+	*  it must not contain raw pointers, use OffsetPtr instead (SharedVector, SharedIndex).
+	*  Memory is never freed individually, it goes away with the segment. Allocate is safe
+	*  to call concurrently, Construct expects a single writing process. Create refuses an
+	*  existing name (std::system_error with EEXIST), call Remove first to replace a segment.
+	*
+	*  Usage:
+	*  auto segment = SharedMemorySegment::Create("/trades", 64 << 20);         // writer
+	*  auto* trades = segment.Construct<SharedVector<Trade>>("trades", segment, 1000000);
+	*
+	*  auto view = SharedMemorySegment::Open("/trades");                       // readers
+	*  auto res = Where(*view.Find<SharedVector<Trade>>("trades"), predicate);
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	class SharedMemorySegment
+	{
+		static constexpr uint64_t Magic = 0x43514c53484d3031ull;
+		static constexpr size_t MaxNamedObjects = 32;
+		static constexpr size_t MaxNameLength = 48;
+
+		struct NamedObject
+		{
+			char name[MaxNameLength];
+			uint64_t offset;
+		};
+
+		struct Header
+		{
+			uint64_t magic;
+			uint64_t size;
+			std::atomic<uint64_t> used;
+			std::atomic<uint64_t> namedObjects;
+			NamedObject directory[MaxNamedObjects];
+		};
+
+	public:
+		static SharedMemorySegment Create(const std::string& name, size_t size)
+		{
+			size = (std::max)(size, sizeof(Header));
+			SharedMemorySegment segment(name, size, true);
+			Header* header = new (segment.data_) Header{};
+			header->size = size;
+			header->used.store(sizeof(Header));
+			header->namedObjects.store(0);
+			header->magic = Magic;
+			return segment;
+		}
+
+		static SharedMemorySegment Open(const std::string& name)
+		{
+			SharedMemorySegment segment(name, 0, false);
+			if (segment.GetHeader()->magic != Magic)
+				throw std::runtime_error("cql::SharedMemorySegment: " + name + " is not a segment");
+			return segment;
+		}
+
+		// Removes the name, the memory lives on until every process unmapped it.
+		static void Remove(const std::string& name)
+		{
+#if !defined(_WIN32)
+			::shm_unlink(PosixName(name).c_str());
+#else
+			(void)name;
+#endif
+		}
+
+		SharedMemorySegment(const SharedMemorySegment&) = delete;
+		SharedMemorySegment& operator=(const SharedMemorySegment&) = delete;
+		SharedMemorySegment(SharedMemorySegment&& other) noexcept : data_(other.data_), size_(other.size_)
+#if defined(_WIN32)
+			, mapping_(other.mapping_)
+#endif
+		{
+			other.data_ = nullptr;
+			other.size_ = 0;
+#if defined(_WIN32)
+			other.mapping_ = nullptr;
+#endif
+		}
+		~SharedMemorySegment() { Unmap(); }
+
+		void* data() const { return data_; }
+		size_t size() const { return size_; }
+		size_t Used() const { return static_cast<size_t>(GetHeader()->used.load()); }
+
+		void* Allocate(size_t bytes, size_t alignment = alignof(std::max_align_t))
+		{
+			Header* header = GetHeader();
+			uint64_t used = header->used.load();
+			uint64_t start;
+			do
+			{
+				start = (used + alignment - 1) / alignment * alignment;
+				if (start + bytes > header->size)
+					throw std::bad_alloc();
+			} while (!header->used.compare_exchange_weak(used, start + bytes));
+			return static_cast<char*>(data_) + start;
+		}
+
+		template<typename T, typename... TArgs>
+		T* Construct(const std::string& name, TArgs&&... args)
+		{
+			if (name.size() >= MaxNameLength)
+				throw std::invalid_argument("cql::SharedMemorySegment: object name too long");
+			Header* header = GetHeader();
+			uint64_t index = header->namedObjects.load();
+			if (index >= MaxNamedObjects)
+				throw std::length_error("cql::SharedMemorySegment: too many named objects");
+			T* object = new (Allocate(sizeof(T), alignof(T))) T(std::forward<TArgs>(args)...);
+			NamedObject& entry = header->directory[index];
+			std::copy(name.begin(), name.end(), entry.name);
+			entry.name[name.size()] = '\0';
+			entry.offset = static_cast<uint64_t>(reinterpret_cast<char*>(object) - static_cast<char*>(data_));
+			header->namedObjects.store(index + 1);
+			return object;
+		}
+
+		// Returns nullptr when no object with that name was constructed.
+		template<typename T>
+		T* Find(const std::string& name) const
+		{
+			Header* header = GetHeader();
+			uint64_t count = header->namedObjects.load();
+			for (uint64_t i = 0; i < count; i++)
+			{
+				if (name == header->directory[i].name)
+					return reinterpret_cast<T*>(static_cast<char*>(data_) + header->directory[i].offset);
+			}
+			return nullptr;
+		}
+
+	private:
+		Header* GetHeader() const { return static_cast<Header*>(data_); }
+
+#if !defined(_WIN32)
+		static std::string PosixName(const std::string& name)
+		{
+			return name.empty() || name[0] != '/' ? "/" + name : name;
+		}
+
+		SharedMemorySegment(const std::string& name, size_t size, bool create)
+		{
+			int file = ::shm_open(PosixName(name).c_str(), create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+			if (file < 0)
+				throw std::system_error(errno, std::generic_category(), "cql::SharedMemorySegment: cannot open " + name);
+			struct stat status {};
+			if ((create && ::ftruncate(file, static_cast<off_t>(size)) != 0) || ::fstat(file, &status) != 0)
+			{
+				int error = errno;
+				::close(file);
+				throw std::system_error(error, std::generic_category(), "cql::SharedMemorySegment: cannot size " + name);
+			}
+			size_ = static_cast<size_t>(status.st_size);
+			void* view = size_ >= sizeof(Header) ? ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0) : MAP_FAILED;
+			int error = errno;
+			::close(file);
+			if (view == MAP_FAILED)
+				throw std::system_error(error, std::generic_category(), "cql::SharedMemorySegment: cannot map " + name);
+			data_ = view;
+		}
+
+		void Unmap()
+		{
+			if (data_ != nullptr)
+				::munmap(data_, size_);
+			data_ = nullptr;
+		}
+#else
+		SharedMemorySegment(const std::string& name, size_t size, bool create)
+		{
+			uint64_t size64 = size;
+			mapping_ = create
+				? CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(size64 >> 32), static_cast<DWORD>(size64), name.c_str())
+				: OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name.c_str());
+			if (mapping_ == nullptr)
+				throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "cql::SharedMemorySegment: cannot open " + name);
+			if (create && GetLastError() == ERROR_ALREADY_EXISTS)
+			{
+				CloseHandle(mapping_);
+				throw std::system_error(EEXIST, std::generic_category(), "cql::SharedMemorySegment: cannot open " + name);
+			}
+			data_ = MapViewOfFile(mapping_, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+			if (data_ == nullptr)
+			{
+				auto error = GetLastError();
+				CloseHandle(mapping_);
+				throw std::system_error(static_cast<int>(error), std::system_category(), "cql::SharedMemorySegment: cannot map " + name);
+			}
+			size_ = create ? size : static_cast<size_t>(GetHeader()->size);
+		}
+
+		void Unmap()
+		{
+			if (data_ != nullptr)
+				UnmapViewOfFile(data_);
+			if (mapping_ != nullptr)
+				CloseHandle(mapping_);
+			data_ = nullptr;
+			mapping_ = nullptr;
+		}
+
+		HANDLE mapping_ = nullptr;
+#endif
+
+		void* data_ = nullptr;
+		size_t size_ = 0;
+	};
+
+	/* SharedVector:
+	*  A fixed-capacity vector of trivially copyable elements whose header and storage both
+	*  live in a SharedMemorySegment. It is a contiguous range, so every query runs on it
+	*  from any process that mapped the segment.
+	*/
+	template<typename TElement>
+	class SharedVector
+	{
+		static_assert(std::is_trivially_copyable<TElement>::value, "SharedVector elements must be trivially copyable");
+
+	public:
+		using value_type = TElement;
+		using iterator = TElement*;
+		using const_iterator = const TElement*;
+
+		SharedVector(SharedMemorySegment& segment, size_t capacity)
+			: data_(static_cast<TElement*>(segment.Allocate(sizeof(TElement) * capacity, alignof(TElement)))), capacity_(capacity) {}
+
+		void push_back(const TElement& element)
+		{
+			if (size_ == capacity_)
+				throw std::length_error("cql::SharedVector: capacity exceeded");
+			data_[size_] = element;
+			size_++;
+		}
+
+		template<typename TContainer>
+		void assign(const TContainer& container)
+		{
+			size_ = 0;
+			for (auto& element : container)
+				push_back(element);
+		}
+
+		TElement* data() { return data_.get(); }
+		const TElement* data() const { return data_.get(); }
+		size_t size() const { return static_cast<size_t>(size_); }
+		size_t capacity() const { return static_cast<size_t>(capacity_); }
+		bool empty() const { return size_ == 0; }
+		TElement* begin() { return data(); }
+		TElement* end() { return data() + size_; }
+		const TElement* begin() const { return data(); }
+		const TElement* end() const { return data() + size_; }
+		TElement& operator[](size_t index) { return data_[index]; }
+		const TElement& operator[](size_t index) const { return data_[index]; }
+
+	private:
+		OffsetPtr<TElement> data_;
+		uint64_t size_ = 0;
+		uint64_t capacity_;
+	};
+
+	/* SharedIndex:
+	*  A sorted (key, position) index over a range, stored in a SharedMemorySegment so
+	*  every process can look keys up without building its own index.
+	*/
+	template<typename TKey>
+	class SharedIndex
+	{
+		static_assert(std::is_trivially_copyable<TKey>::value, "SharedIndex keys must be trivially copyable");
+
+	public:
+		struct Entry
+		{
+			TKey key;
+			uint64_t position;
+		};
+
+		template<typename TContainer, typename TKeyFunc>
+		SharedIndex(SharedMemorySegment& segment, const TContainer& container, const TKeyFunc& keyFunc)
+			: entries_(segment, static_cast<size_t>(std::distance(std::begin(container), std::end(container))))
+		{
+			uint64_t position = 0;
+			for (auto& element : container)
+				entries_.push_back(Entry{ keyFunc(element), position++ });
+			std::stable_sort(entries_.begin(), entries_.end(), [](const Entry& l, const Entry& r) { return l.key < r.key; });
+		}
+
+		// Returns the positions of the elements whose key equals the given one.
+		IteratorRange<const Entry*> Find(const TKey& key) const
+		{
+			auto range = std::equal_range(entries_.begin(), entries_.end(), Entry{ key, 0 },
+				[](const Entry& l, const Entry& r) { return l.key < r.key; });
+			return IteratorRange<const Entry*>(range.first, range.second);
+		}
+
+		size_t size() const { return entries_.size(); }
+
+	private:
+		SharedVector<Entry> entries_;
+	};
+
+	/* OperationCanceled:
+	*  Thrown by cancellable queries once their CancellationToken is canceled or past its deadline.
+	*/
+	class OperationCanceled : public std::runtime_error
+	{
+	public:
+		OperationCanceled() : std::runtime_error("cql: query canceled") {}
+	};
+
+	/* CancellationToken:
+	*  A shared cancellation flag with an optional deadline. Copies share their state, so
+	*  the caller keeps one copy to cancel while a query polls another one.
+	*
+	*  Usage:
+	*  CancellationToken token;
+	*  token.CancelAfter(std::chrono::seconds(5));
+	*  auto res = GroupBy(ls, func, token);  // throws OperationCanceled after 5 seconds
+	*/
+	class CancellationToken
+	{
+		struct State
+		{
+			std::atomic<bool> canceled{ false };
+			std::atomic<int64_t> deadline{ (std::numeric_limits<int64_t>::max)() };
+		};
+
+	public:
+		CancellationToken() : state_(std::make_shared<State>()) {}
+
+		void Cancel() { state_->canceled.store(true, std::memory_order_relaxed); }
+		void CancelAt(std::chrono::steady_clock::time_point deadline)
+		{
+			state_->deadline.store(deadline.time_since_epoch().count(), std::memory_order_relaxed);
+		}
+		template<typename TRep, typename TPeriod>
+		void CancelAfter(std::chrono::duration<TRep, TPeriod> timeout)
+		{
+			CancelAt(std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+		}
+
+		bool IsCanceled() const
+		{
+			if (state_->canceled.load(std::memory_order_relaxed))
+				return true;
+			return std::chrono::steady_clock::now().time_since_epoch().count() >= state_->deadline.load(std::memory_order_relaxed);
+		}
+
+		void ThrowIfCanceled() const
+		{
+			if (IsCanceled())
+				throw OperationCanceled();
+		}
+
+	private:
+		std::shared_ptr<State> state_;
+	};
+
+	namespace detail
+	{
+		// Polls the token every CheckInterval steps, so the per-element cost is one decrement.
+		class CancellationCheckpoint
+		{
+		public:
+			static constexpr size_t CheckInterval = 4096;
+
+			explicit CancellationCheckpoint(const CancellationToken& token) : token_(token) { token_.ThrowIfCanceled(); }
+
+			void Step()
+			{
+				if (--countdown_ == 0)
+				{
+					countdown_ = CheckInterval;
+					token_.ThrowIfCanceled();
+				}
+			}
+
+			template<typename TRange>
+			void BeginPhase(const char*, const TRange&) {}
+
+		private:
+			const CancellationToken& token_;
+			size_t countdown_ = CheckInterval;
+		};
+	}
+
+	/* Cancellable GroupBy, Join and OrderBy:
+	*  Same as the plain queries, but they poll the token while running and throw
+	*  OperationCanceled when it is canceled or its deadline passed. A canceled OrderBy
+	*  leaves the container with all of its elements in an unspecified order.
+	*
+	*  Usage:
+	*  CancellationToken token;
+	*  token.CancelAfter(std::chrono::milliseconds(200));
+	*  auto res = Join(vec, ls, func1, func2, token);
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc>
+	auto GroupBy(const TContainer& container, const TGroupingMemberFunc& groupingMemberFunc, const CancellationToken& token)
+	{
+		detail::CancellationCheckpoint checkpoint(token);
+		return detail::GroupBy(container, groupingMemberFunc, checkpoint);
+	}
+
+	template<typename TContainer1, typename TContainer2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2>
+	auto Join(const TContainer1& container1,
+		const TContainer2& container2,
+		const TJoiningMemberFunc1& joiningMemberFunc1,
+		const TJoiningMemberFunc2& joiningMemberFunc2,
+		const CancellationToken& token)
+	{
+		detail::CancellationCheckpoint checkpoint(token);
+		return detail::Join(container1, container2, joiningMemberFunc1, joiningMemberFunc2, checkpoint);
+	}
+
+	template<typename TContainer, typename TFunc>
+	void OrderBy(TContainer& container, const TFunc& func, const CancellationToken& token)
+	{
+		detail::CancellationCheckpoint checkpoint(token);
+		OrderBy(container, [&func, &checkpoint](const auto& l, const auto& r)
+		{
+			checkpoint.Step();
+			return func(l, r);
+		});
+	}
+
+	/* QueryProgress:
+	*  Passed to progress callbacks: the running phase of the query and how many of the
+	*  phase's elements (comparisons for OrderBy, estimated) were processed so far. Ranges
+	*  without size() are not walked up front: total is UnknownTotal until the phase ends.
+	*/
+	struct QueryProgress
+	{
+		static constexpr size_t UnknownTotal = (std::numeric_limits<size_t>::max)();
+
+		const char* phase;
+		size_t processed;
+		size_t total;
+	};
+
+	/* QueryMonitor:
+	*  Optional progress reporting and cancellation for long-running queries. The callback
+	*  is invoked at the start and end of each phase and every `interval` elements in
+	*  between, on the thread running the query.
+	*
+	*  Usage:
+	*  CancellationToken token;
+	*  auto monitor = QueryMonitor()
+	*      .OnProgress([](const QueryProgress& p) { std::cout << p.phase << ' ' << p.processed << '/' << p.total << '\n'; })
+	*      .WithCancellation(token);
+	*  auto res = Join(vec, ls, func1, func2, monitor);
+	*/
+	class QueryMonitor
+	{
+	public:
+		QueryMonitor& OnProgress(std::function<void(const QueryProgress&)> callback, size_t interval = 64 * 1024)
+		{
+			callback_ = std::move(callback);
+			interval_ = (std::max)(interval, size_t(1));
+			return *this;
+		}
+
+		QueryMonitor& WithCancellation(CancellationToken token)
+		{
+			token_ = std::move(token);
+			return *this;
+		}
+
+		const std::function<void(const QueryProgress&)>& Callback() const { return callback_; }
+		const std::optional<CancellationToken>& Token() const { return token_; }
+		size_t Interval() const { return interval_; }
+
+	private:
+		std::function<void(const QueryProgress&)> callback_;
+		std::optional<CancellationToken> token_;
+		size_t interval_ = 64 * 1024;
+	};
+
+	namespace detail
+	{
+		class MonitorCheckpoint
+		{
+		public:
+			explicit MonitorCheckpoint(const QueryMonitor& monitor)
+				: monitor_(monitor), 
+				interval_(monitor.Callback() ? monitor.Interval() : CancellationCheckpoint::CheckInterval), 
+				countdown_(interval_)
+			{
+				if (monitor_.Token())
+					monitor_.Token()->ThrowIfCanceled();
+			}
+
+			void Step()
+			{
+				if (--countdown_ == 0)
+				{
+					countdown_ = interval_;
+					processed_ += interval_;
+					if (monitor_.Token())
+						monitor_.Token()->ThrowIfCanceled();
+					Report((std::min)(processed_, total_));
+				}
+			}
+
+			template<typename TRange>
+			void BeginPhase(const char* phase, const TRange& range)
+			{
+				if constexpr (HasSize<TRange>::value)
+					Begin(phase, static_cast<size_t>(std::size(range)));
+				else
+					Begin(phase, QueryProgress::UnknownTotal);
+			}
+
+			void Begin(const char* phase, size_t total)
+			{
+				Finish();
+				phase_ = phase;
+				total_ = total;
+				processed_ = 0;
+				countdown_ = interval_;
+				Report(0);
+			}
+
+			// Reports the running phase as complete.
+			void Finish()
+			{
+				if (phase_ != nullptr && total_ == QueryProgress::UnknownTotal)
+					total_ = processed_ + (interval_ - countdown_);
+				if (phase_ != nullptr)
+					Report(total_);
+				phase_ = nullptr;
+			}
+
+		private:
+			void Report(size_t processed) const
+			{
+				if (monitor_.Callback() && phase_ != nullptr)
+					monitor_.Callback()(QueryProgress{ phase_, processed, total_ });
+			}
+
+			const QueryMonitor& monitor_;
+			size_t interval_;
+			size_t countdown_;
+			size_t processed_ = 0;
+			size_t total_ = 0;
+			const char* phase_ = nullptr;
+		};
+	}
+
+	/* Monitored GroupBy, Join and OrderBy:
+	*  Same as the plain queries, reporting progress to the monitor's callback and honoring
+	*  its cancellation token, if any.
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc>
+	auto GroupBy(const TContainer& container, const TGroupingMemberFunc& groupingMemberFunc, const QueryMonitor& monitor)
+	{
+		detail::MonitorCheckpoint checkpoint(monitor);
+		auto result = detail::GroupBy(container, groupingMemberFunc, checkpoint);
+		checkpoint.Finish();
+		return result;
+	}
+
+	template<typename TContainer1, typename TContainer2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2>
+	auto Join(const TContainer1& container1,
+		const TContainer2& container2,
+		const TJoiningMemberFunc1& joiningMemberFunc1,
+		const TJoiningMemberFunc2& joiningMemberFunc2,
+		const QueryMonitor& monitor)
+	{
+		detail::MonitorCheckpoint checkpoint(monitor);
+		auto result = detail::Join(container1, container2, joiningMemberFunc1, joiningMemberFunc2, checkpoint);
+		checkpoint.Finish();
+		return result;
+	}
+
+	template<typename TContainer, typename TFunc>
+	void OrderBy(TContainer& container, const TFunc& func, const QueryMonitor& monitor)
+	{
+		detail::MonitorCheckpoint checkpoint(monitor);
+		size_t size = static_cast<size_t>(std::distance(std::begin(container), std::end(container)));
+		size_t depth = 1;
+		while ((size_t(1) << depth) < size)
+			depth++;
+		checkpoint.Begin("OrderBy", size * depth);
+		OrderBy(container, [&func, &checkpoint](const auto& l, const auto& r)
+		{
+			checkpoint.Step();
+			return func(l, r);
+		});
+		checkpoint.Finish();
+	}
+
+	/* QueryTask:
+	*  The result of a query started with RunAsync. It can be waited on with Get() or,
+	*  with C++20 coroutines, awaited with co_await: the awaiting coroutine is suspended
+	*  and resumed on the thread that finished the query, never blocking its caller.
+	*  Exceptions thrown by the query (including OperationCanceled) are rethrown to the
+	*  consumer.
+	*/
+	template<typename TResult>
+	class QueryTask
+	{
+		using StoredType = std::conditional_t<std::is_void<TResult>::value, std::monostate, TResult>;
+
+		struct State
+		{
+			std::mutex mutex;
+			std::condition_variable finished;
+			bool ready = false;
+			std::optional<StoredType> value;
+			std::exception_ptr error;
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+			std::coroutine_handle<> continuation;
+#endif
+		};
+
+	public:
+		QueryTask() : state_(std::make_shared<State>()) {}
+
+		bool IsReady() const
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			return state_->ready;
+		}
+
+		void Wait() const
+		{
+			std::unique_lock<std::mutex> lock(state_->mutex);
+			state_->finished.wait(lock, [this]() { return state_->ready; });
+		}
+
+		TResult Get()
+		{
+			Wait();
+			return TakeResult();
+		}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+		bool await_ready() const { return IsReady(); }
+		bool await_suspend(std::coroutine_handle<> continuation)
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			if (state_->ready)
+				return false;
+			state_->continuation = continuation;
+			return true;
+		}
+		TResult await_resume() { return TakeResult(); }
+#endif
+
+		// Called by the thread that ran the query.
+		template<typename TFunc>
+		void Run(TFunc& func)
+		{
+			std::optional<StoredType> value;
+			std::exception_ptr error;
+			try
+			{
+				if constexpr (std::is_void<TResult>::value)
+				{
+					func();
+					value.emplace();
+				}
+				else
+				{
+					value.emplace(func());
+				}
+			}
+			catch (...)
+			{
+				error = std::current_exception();
+			}
+
+			std::unique_lock<std::mutex> lock(state_->mutex);
+			state_->value = std::move(value);
+			state_->error = error;
+			state_->ready = true;
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+			auto continuation = state_->continuation;
+			state_->continuation = nullptr;
+#endif
+			state_->finished.notify_all();
+			lock.unlock();
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+			if (continuation)
+				continuation.resume();
+#endif
+		}
+
+	private:
+		TResult TakeResult()
+		{
+			std::lock_guard<std::mutex> lock(state_->mutex);
+			if (state_->error)
+				std::rethrow_exception(state_->error);
+			if constexpr (!std::is_void<TResult>::value)
+				return std::move(*state_->value);
+		}
+
+		std::shared_ptr<State> state_;
+	};
+
+	/* RunAsync:
+	*  Runs a query on an executor and returns a QueryTask for its result. The executor is
+	*  any callable taking a std::function<void()> (e.g. a thread pool's submit function),
+	*  without one the query runs on a new thread. Whatever the query refers to must
+	*  outlive the task; pass a CancellationToken to the query to make it abortable.
+	*
+	*  Usage:
+	*  CancellationToken token;
+	*  token.CancelAfter(std::chrono::seconds(2));
+	*  auto task = RunAsync([&]() { return GroupBy(ls, func, token); });
+	*  auto res = co_await task;  // or task.Get()
+	*
+	*  Minimum C++ standard: C++17 (co_await requires C++20 coroutines).
+	*/
+	template<typename TFunc, typename TExecutor>
+	auto RunAsync(TFunc func, const TExecutor& executor)
+	{
+		using TResult = std::invoke_result_t<TFunc&>;
+		QueryTask<TResult> task;
+		executor(std::function<void()>([task, func = std::move(func)]() mutable { task.Run(func); }));
+		return task;
+	}
+
+	template<typename TFunc>
+	auto RunAsync(TFunc func)
+	{
+		return RunAsync(std::move(func), [](std::function<void()> work) { std::thread(std::move(work)).detach(); });
+	}
+
+	/* GroupByAsync, JoinAsync and OrderByAsync:
+	*  Queries started with RunAsync, taking a CancellationToken or a QueryMonitor.
+	*  The containers must outlive the task.
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TGroupingMemberFunc, typename TControl = CancellationToken>
+	auto GroupByAsync(const TContainer& container, TGroupingMemberFunc groupingMemberFunc, TControl control = TControl())
+	{
+		return RunAsync([&container, groupingMemberFunc, control]() { return GroupBy(container, groupingMemberFunc, control); });
+	}
+
+	template<typename TContainer1, 
+		typename TContainer2, 
+		typename TJoiningMemberFunc1, 
+		typename TJoiningMemberFunc2, 
+		typename TControl = CancellationToken>
+	auto JoinAsync(const TContainer1& container1,
+		const TContainer2& container2,
+		TJoiningMemberFunc1 joiningMemberFunc1,
+		TJoiningMemberFunc2 joiningMemberFunc2,
+		TControl control = TControl())
+	{
+		return RunAsync([&container1, &container2, joiningMemberFunc1, joiningMemberFunc2, control]()
+		{
+			return Join(container1, container2, joiningMemberFunc1, joiningMemberFunc2, control);
+		});
+	}
+
+	template<typename TContainer, typename TFunc, typename TControl = CancellationToken>
+	QueryTask<void> OrderByAsync(TContainer& container, TFunc func, TControl control = TControl())
+	{
+		return RunAsync([&container, func, control]() { OrderBy(container, func, control); });
+	}
+
+	namespace detail
+	{
+		// Shared by every VersionedContainer instantiation, so ids are unique across element types.
+		inline uint64_t NextContainerId()
+		{
+			static std::atomic<uint64_t> nextId{ 1 };
+			return nextId.fetch_add(1);
+		}
+
+		// Told by a VersionedContainer when it is destroyed, so state kept by its id can go.
+		class ContainerListener
+		{
+		public:
+			virtual ~ContainerListener() = default;
+			virtual void OnDestroyed(uint64_t id) = 0;
+		};
+	}
+
+	/* ContainerObserver:
+	*  Receives the row-level changes made to a VersionedContainer it is attached to. An
+	*  update is reported as the removal of the old value followed by the insertion of the
+	*  new one; changes made through Modify are reported as OnReset.
+	*/
+	template<typename TElement>
+	class ContainerObserver
+	{
+	public:
+		virtual ~ContainerObserver() = default;
+		virtual void OnInsert(const TElement& element) = 0;
+		virtual void OnRemove(const TElement& element) = 0;
+		virtual void OnReset() = 0;
+	};
+
+	/* VersionedContainer:
+	*  Wraps a container with a version counter that is bumped by every change made through
+	*  cql (Insert, Update, Delete, Modify). Read access is const, so the version can be
+	*  trusted to identify the content. Each instance also has a process-wide unique id.
+	*  Attached ContainerObservers are told about every change.
+	*
+	*  Usage:
+	*  VersionedContainer<vector<Employee>> employees(loadEmployees());
+	*  Update(employees, [](Employee& e) { e.salary += 10; });  // version + 1
+	*  auto res = GroupBy(employees.Get(), func);
+	*/
+	template<typename TContainer>
+	class VersionedContainer
+	{
+	public:
+		using value_type = typename RangeValue<TContainer>::type;
+		using const_iterator = decltype(std::begin(std::declval<const TContainer&>()));
+
+		VersionedContainer() : id_(NextId()) {}
+		explicit VersionedContainer(TContainer container) : container_(std::move(container)), id_(NextId()) {}
+		VersionedContainer(const VersionedContainer& other) : container_(other.container_), id_(NextId()) {}
+		VersionedContainer& operator=(const VersionedContainer& other)
+		{
+			Modify([&other](TContainer& container) { container = other.container_; });
+			return *this;
+		}
+
+		~VersionedContainer()
+		{
+			for (auto& listener : listeners_)
+			{
+				if (auto alive = listener.lock())
+					alive->OnDestroyed(id_);
+			}
+		}
+
+		const TContainer& Get() const { return container_; }
+		const_iterator begin() const { return std::begin(container_); }
+		const_iterator end() const { return std::end(container_); }
+		size_t size() const { return container_.size(); }
+		bool empty() const { return container_.empty(); }
+
+		uint64_t Version() const { return version_; }
+		uint64_t Id() const { return id_; }
+
+		void Insert(const value_type& element)
+		{
+			container_.insert(container_.end(), element);
+			version_++;
+			NotifyInsert(element);
+		}
+
+		// Updates the elements matching the predicate, returns how many there were. Set
+		// elements are their own keys, so they are extracted, updated and reinserted.
+		template<typename TFunc, typename TSetFunc>
+		size_t UpdateWhere(const TFunc& predicate, const TSetFunc& setFunc)
+		{
+			size_t updated = 0;
+			if constexpr (IsSetLike<TContainer>::value)
+			{
+				std::vector<typename TContainer::node_type> nodes;
+				for (auto itr = container_.begin(); itr != container_.end();)
+				{
+					if (!predicate(*itr))
+					{
+						++itr;
+						continue;
+					}
+					for (auto observer : observers_)
+						observer->OnRemove(*itr);
+					nodes.push_back(container_.extract(itr++));
+					setFunc(nodes.back().value());
+				}
+				for (auto& node : nodes)
+				{
+					if constexpr (HasUniqueKeys<TContainer>::value)
+					{
+						auto inserted = container_.insert(std::move(node));
+						if (inserted.inserted)
+							NotifyInsert(*inserted.position);
+					}
+					else
+						NotifyInsert(*container_.insert(std::move(node)));
+				}
+				updated = nodes.size();
+			}
+			else
+			{
+				for (auto& element : container_)
+				{
+					if (!predicate(element))
+						continue;
+					for (auto observer : observers_)
+						observer->OnRemove(element);
+					setFunc(element);
+					NotifyInsert(element);
+					updated++;
+				}
+			}
+			if (updated > 0)
+				version_++;
+			return updated;
+		}
+
+		// Removes the elements matching the predicate, returns how many there were. The
+		// predicate is evaluated once per element, matches are reported before the erase.
+		template<typename TFunc>
+		size_t DeleteWhere(const TFunc& predicate)
+		{
+			size_t removed = 0;
+			Delete(container_, [&](const value_type& element)
+			{
+				if (!predicate(element))
+					return false;
+				for (auto observer : observers_)
+					observer->OnRemove(element);
+				removed++;
+				return true;
+			});
+			if (removed > 0)
+				version_++;
+			return removed;
+		}
+
+		// Gives mutable access to the container for changes cql has no statement for.
+		template<typename TFunc>
+		void Modify(const TFunc& func)
+		{
+			func(container_);
+			version_++;
+			for (auto observer : observers_)
+				observer->OnReset();
+		}
+
+		void Attach(ContainerObserver<value_type>* observer) { observers_.push_back(observer); }
+		void Detach(ContainerObserver<value_type>* observer)
+		{
+			observers_.erase(std::remove(observers_.begin(), observers_.end(), observer), observers_.end());
+		}
+
+	private:
+		friend class QueryCache;
+
+		static uint64_t NextId() { return detail::NextContainerId(); }
+
+		void NotifyInsert(const value_type& element) const
+		{
+			for (auto observer : observers_)
+				observer->OnInsert(element);
+		}
+
+		void AddListener(const std::shared_ptr<detail::ContainerListener>& listener) const
+		{
+			std::lock_guard<std::mutex> lock(listenersMutex_);
+			listeners_.erase(std::remove_if(listeners_.begin(), listeners_.end(), 
+				[](const auto& other) { return other.expired(); }), listeners_.end());
+			for (const auto& other : listeners_)
+			{
+				if (other.lock() == listener)
+					return;
+			}
+			listeners_.push_back(listener);
+		}
+
+		TContainer container_;
+		std::vector<ContainerObserver<value_type>*> observers_;
+		mutable std::mutex listenersMutex_;
+		mutable std::vector<std::weak_ptr<detail::ContainerListener>> listeners_;
+		uint64_t version_ = 0;
+		uint64_t id_;
+	};
+
+	/* Update and Delete Statements on a VersionedContainer:
+	*  Same as on the wrapped container, the version is bumped when an element was changed.
+	*/
+	template<typename TContainer, typename TSetFunc>
+	void Update(VersionedContainer<TContainer>& container, const TSetFunc& setFunc)
+	{
+		container.UpdateWhere([](const auto&) { return true; }, setFunc);
+	}
+
+	template<typename TContainer, typename TFunc, typename TSetFunc>
+	void Update(VersionedContainer<TContainer>& container, const TFunc& predicate, const TSetFunc& setFunc)
+	{
+		container.UpdateWhere(predicate, setFunc);
+	}
+
+	template<typename TContainer, typename TFunc>
+	void Delete(VersionedContainer<TContainer>& container, const TFunc& predicate)
+	{
+		container.DeleteWhere(predicate);
+	}
+
+	/* MaterializedAggregate:
+	*  A per-key count and sum over a VersionedContainer, kept up to date as rows are
+	*  inserted, updated and deleted through cql: each change costs one hash lookup instead
+	*  of re-running GroupBy. Keys whose last row is removed disappear. Changes made with
+	*  Modify rebuild the aggregate. Keys are stored as GroupingKeyTraits::StorageType, so
+	*  a key function returning std::string_view into the element is safe. The container
+	*  must outlive the aggregate, which must not be moved while attached.
+	*
+	*  Usage:
+	*  VersionedContainer<vector<Event>> events;
+	*  MaterializedAggregate bytesByHost(events, [](const Event& e) { return e.host; }, [](const Event& e) { return e.bytes; });
+	*  events.Insert({ "a", 100 });
+	*  bytesByHost.Sum("a");  // 100
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TContainer, typename TKeyFunc, typename TValueFunc>
+	class MaterializedAggregate : public ContainerObserver<typename RangeValue<TContainer>::type>
+	{
+		using TElement = typename RangeValue<TContainer>::type;
+
+	public:
+		using GroupingMemberType = std::decay_t<decltype(std::declval<TKeyFunc&>()(std::declval<const TElement&>()))>;
+		using KeyType = typename GroupingKeyTraits<GroupingMemberType>::StorageType;
+		using ValueType = std::decay_t<decltype(std::declval<TValueFunc&>()(std::declval<const TElement&>()))>;
+
+		struct Aggregate
+		{
+			size_t count = 0;
+			ValueType sum{};
+		};
+
+		MaterializedAggregate(VersionedContainer<TContainer>& container, TKeyFunc keyFunc, TValueFunc valueFunc)
+			: container_(container), keyFunc_(std::move(keyFunc)), valueFunc_(std::move(valueFunc))
+		{
+			OnReset();
+			container_.Attach(this);
+		}
+		MaterializedAggregate(const MaterializedAggregate&) = delete;
+		MaterializedAggregate& operator=(const MaterializedAggregate&) = delete;
+		~MaterializedAggregate() override { container_.Detach(this); }
+
+		size_t Count(const GroupingMemberType& key) const
+		{
+			auto itr = Find(key);
+			return itr == aggregates_.end() ? 0 : itr->second.count;
+		}
+
+		ValueType Sum(const GroupingMemberType& key) const
+		{
+			auto itr = Find(key);
+			return itr == aggregates_.end() ? ValueType{} : itr->second.sum;
+		}
+
+		double Average(const GroupingMemberType& key) const
+		{
+			auto itr = Find(key);
+			return itr == aggregates_.end() ? 0.0 : static_cast<double>(itr->second.sum) / static_cast<double>(itr->second.count);
+		}
+
+		const FlatHashMap<KeyType, Aggregate>& Results() const { return aggregates_; }
+		size_t size() const { return aggregates_.size(); }
+
+		void OnInsert(const TElement& element) override
+		{
+			Aggregate& aggregate = detail::FindOrInsert(aggregates_, keyFunc_(element));
+			aggregate.count++;
+			aggregate.sum += valueFunc_(element);
+		}
+
+		void OnRemove(const TElement& element) override
+		{
+			auto itr = aggregates_.find(detail::ProbeKey<decltype(aggregates_)>(keyFunc_(element)));
+			if (itr == aggregates_.end())
+				return;
+			if (--itr->second.count == 0)
+				aggregates_.erase(itr);
+			else
+				itr->second.sum -= valueFunc_(element);
+		}
+
+		void OnReset() override
+		{
+			aggregates_.clear();
+			for (auto& element : container_)
+				OnInsert(element);
+		}
+
+	private:
+		typename FlatHashMap<KeyType, Aggregate>::const_iterator Find(const GroupingMemberType& key) const { return aggregates_.find(detail::ProbeKey<decltype(aggregates_)>(key)); }
+
+		VersionedContainer<TContainer>& container_;
+		TKeyFunc keyFunc_;
+		TValueFunc valueFunc_;
+		FlatHashMap<KeyType, Aggregate> aggregates_;
+	};
+
+	/* IncrementalDistinct:
+	*  Distinct over an append-only stream. Each batch passed to Add returns only the
+	*  elements that were never seen before, in arrival order. The state is one hash set
+	*  entry per distinct element, so batches never rescan earlier data.
+	*
+	*  Usage:
+	*  IncrementalDistinct<std::string> users;
+	*  auto fresh = users.Add(batch);  // users not seen in any previous batch
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TElement, typename THash = typename detail::DefaultHashing<TElement>::Hash>
+	class IncrementalDistinct
+	{
+	public:
+		template<typename TContainer>
+		std::vector<TElement> Add(const TContainer& batch)
+		{
+			std::vector<TElement> added;
+			for (auto& element : batch)
+			{
+				if (seen_.insert(element).second)
+					added.push_back(element);
+			}
+			return added;
+		}
+
+		bool Contains(const TElement& element) const { return seen_.count(element) > 0; }
+		size_t size() const { return seen_.size(); }
+
+	private:
+		FlatHashSet<TElement, THash> seen_;
+	};
+
+	/* IncrementalJoin:
+	*  Join over two append-only streams. Appending a batch to either side returns only
+	*  the pairs it newly matches against everything appended to the other side so far,
+	*  so re-running Join per batch is replaced by one hash lookup per appended element.
+	*  Every appended element is kept, bucketed by its key.
+	*
+	*  Usage:
+	*  auto join = MakeIncrementalJoin<Order, Payment>([](const Order& o) { return o.id; }, [](const Payment& p) { return p.orderId; });
+	*  auto matched = join.AddFirst(orders);   // vector<pair<Order, Payment>>
+	*  matched = join.AddSecond(payments);
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TElement1, typename TElement2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2>
+	class IncrementalJoin
+	{
+		using GroupingMemberType = std::decay_t<decltype(std::declval<const TJoiningMemberFunc1&>()(std::declval<const TElement1&>()))>;
+		using KeyType = typename GroupingKeyTraits<GroupingMemberType>::StorageType;
+
+	public:
+		using MatchType = std::pair<TElement1, TElement2>;
+
+		IncrementalJoin(TJoiningMemberFunc1 joiningMemberFunc1, TJoiningMemberFunc2 joiningMemberFunc2)
+			: joiningMemberFunc1_(std::move(joiningMemberFunc1)), joiningMemberFunc2_(std::move(joiningMemberFunc2)) {}
+
+		template<typename TContainer>
+		std::vector<MatchType> AddFirst(const TContainer& batch)
+		{
+			std::vector<MatchType> matched;
+			for (auto& element : batch)
+			{
+				auto& bucket = detail::FindOrInsert(buckets_, joiningMemberFunc1_(element));
+				for (auto& other : bucket.second)
+					matched.emplace_back(element, other);
+				bucket.first.push_back(element);
+			}
+			return matched;
+		}
+
+		template<typename TContainer>
+		std::vector<MatchType> AddSecond(const TContainer& batch)
+		{
+			std::vector<MatchType> matched;
+			for (auto& element : batch)
+			{
+				auto& bucket = detail::FindOrInsert(buckets_, joiningMemberFunc2_(element));
+				for (auto& other : bucket.first)
+					matched.emplace_back(other, element);
+				bucket.second.push_back(element);
+			}
+			return matched;
+		}
+
+		size_t KeyCount() const { return buckets_.size(); }
+
+	private:
+		using Bucket = std::pair<std::vector<TElement1>, std::vector<TElement2>>;
+
+		TJoiningMemberFunc1 joiningMemberFunc1_;
+		TJoiningMemberFunc2 joiningMemberFunc2_;
+		FlatHashMap<KeyType, Bucket> buckets_;
+	};
+
+	template<typename TElement1, typename TElement2, typename TJoiningMemberFunc1, typename TJoiningMemberFunc2>
+	auto MakeIncrementalJoin(TJoiningMemberFunc1 joiningMemberFunc1, TJoiningMemberFunc2 joiningMemberFunc2)
+	{
+		return IncrementalJoin<TElement1, TElement2, TJoiningMemberFunc1, TJoiningMemberFunc2>(std::move(joiningMemberFunc1), std::move(joiningMemberFunc2));
+	}
+
+	/* QueryCache:
+	*  Caches query results keyed by a query id chosen by the caller and the identity and
+	*  version of the VersionedContainers it reads. A query issued again on unchanged
+	*  containers returns the cached result, a change to any of them recomputes it.
+	*  Results are shared, immutable and stay valid after being evicted. Results computed
+	*  from a container are evicted when that container is destroyed. Thread-safe.
+	*
+	*  Usage:
+	*  QueryCache cache;
+	*  auto res = cache.GetOrCompute("salary by department", employees, [](const auto& e) {
+	*      return AggregateBy(e, [](const Employee& x) { return x.department; }, 0.0, sumSalary);
+	*  });
+	*  // res is a std::shared_ptr<const std::map<std::string, double>>
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	class QueryCache
+	{
+		struct Entry
+		{
+			std::vector<uint64_t> versions;
+			std::any result;
+		};
+		using Key = std::pair<std::string, std::vector<uint64_t>>;
+
+		// Shared with the containers the cache reads, which may outlive the cache.
+		class Entries : public detail::ContainerListener
+		{
+		public:
+			void OnDestroyed(uint64_t id) override
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				for (auto itr = entries.begin(); itr != entries.end();)
+				{
+					const auto& ids = itr->first.second;
+					if (std::find(ids.begin(), ids.end(), id) != ids.end())
+						itr = entries.erase(itr);
+					else
+						++itr;
+				}
+			}
+
+			mutable std::mutex mutex;
+			std::map<Key, Entry> entries;
+		};
+
+	public:
+		QueryCache() : entries_(std::make_shared<Entries>()) {}
+		QueryCache(const QueryCache&) = delete;
+		QueryCache& operator=(const QueryCache&) = delete;
+
+		template<typename TContainer, typename TQueryFunc>
+		auto GetOrCompute(const std::string& queryId, const VersionedContainer<TContainer>& container, const TQueryFunc& query)
+		{
+			using TResult = std::decay_t<decltype(query(container.Get()))>;
+			container.AddListener(entries_);
+			return Lookup<TResult>(Key(queryId, { container.Id() }), { container.Version() },
+				[&]() { return query(container.Get()); });
+		}
+
+		template<typename TContainer1, typename TContainer2, typename TQueryFunc>
+		auto GetOrCompute(const std::string& queryId, 
+			const VersionedContainer<TContainer1>& container1, 
+			const VersionedContainer<TContainer2>& container2, 
+			const TQueryFunc& query)
+		{
+			using TResult = std::decay_t<decltype(query(container1.Get(), container2.Get()))>;
+			container1.AddListener(entries_);
+			container2.AddListener(entries_);
+			return Lookup<TResult>(Key(queryId, { container1.Id(), container2.Id() }), { container1.Version(), container2.Version() },
+				[&]() { return query(container1.Get(), container2.Get()); });
+		}
+
+		// Drops every cached result that was computed from the given container.
+		template<typename TContainer>
+		void Invalidate(const VersionedContainer<TContainer>& container)
+		{
+			entries_->OnDestroyed(container.Id());
+		}
+
+		void Clear()
+		{
+			std::lock_guard<std::mutex> lock(entries_->mutex);
+			entries_->entries.clear();
+		}
+
+		size_t size() const
+		{
+			std::lock_guard<std::mutex> lock(entries_->mutex);
+			return entries_->entries.size();
+		}
+
+	private:
+		template<typename TResult, typename TComputeFunc>
+		std::shared_ptr<const TResult> Lookup(Key key, std::vector<uint64_t> versions, const TComputeFunc& compute)
+		{
+			{
+				std::lock_guard<std::mutex> lock(entries_->mutex);
+				auto itr = entries_->entries.find(key);
+				if (itr != entries_->entries.end() && itr->second.versions == versions)
+				{
+					auto cached = std::any_cast<std::shared_ptr<const TResult>>(&itr->second.result);
+					if (cached == nullptr)
+						throw std::logic_error("cql::QueryCache: query id '" + key.first + "' reused with another result type");
+					return *cached;
+				}
+			}
+
+			auto result = std::make_shared<const TResult>(compute());
+			std::lock_guard<std::mutex> lock(entries_->mutex);
+			entries_->entries[std::move(key)] = Entry{ std::move(versions), result };
+			return result;
+		}
+
+		std::shared_ptr<Entries> entries_;
+	};
+
+	/* SnapshotTable:
+	*  A table whose readers query consistent snapshots while a writer changes it. Rows
+	*  live in fixed-size copy-on-write chunks: a write copies only the chunks it touches,
+	*  builds a new chunk directory sharing all the others and publishes it with a pointer
+	*  swap. Taking a snapshot only copies that pointer, so readers never wait for a write
+	*  to finish and a snapshot stays valid (and unchanged) for as long as it is held.
+	*  Writes are serialized among themselves.
+	*
+	*  Usage:
+	*  SnapshotTable<Employee> employees(loadEmployees());
+	*  // reader threads
+	*  auto snapshot = employees.Snapshot();
+	*  auto res = GroupBy(snapshot, [](const Employee& e) { return e.department; });
+	*  // writer thread
+	*  Update(employees, [](const Employee& e) { return e.id == 7; }, [](Employee& e) { e.salary += 10; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TElement, size_t ChunkSize = 1024>
+	class SnapshotTable
+	{
+		static_assert(ChunkSize > 0, "cql::SnapshotTable: ChunkSize must be positive");
+
+		using Chunk = std::vector<TElement>;
+		struct State
+		{
+			std::vector<std::shared_ptr<const Chunk>> chunks;
+			size_t size = 0;
+			uint64_t version = 0;
+		};
+
+	public:
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = TElement;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const TElement*;
+			using reference = const TElement&;
+
+			const_iterator() = default;
+
+			reference operator*() const { return (*(*chunks_)[chunk_])[index_]; }
+			pointer operator->() const { return &**this; }
+
+			const_iterator& operator++()
+			{
+				if (++index_ == (*chunks_)[chunk_]->size())
+				{
+					chunk_++;
+					index_ = 0;
+				}
+				return *this;
+			}
+
+			const_iterator operator++(int)
+			{
+				const_iterator copy = *this;
+				++*this;
+				return copy;
+			}
+
+			bool operator==(const const_iterator& other) const { return chunk_ == other.chunk_ && index_ == other.index_; }
+			bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+		private:
+			friend class SnapshotTable;
+			const_iterator(const std::vector<std::shared_ptr<const Chunk>>* chunks, size_t chunk) : chunks_(chunks), chunk_(chunk) {}
+
+			const std::vector<std::shared_ptr<const Chunk>>* chunks_ = nullptr;
+			size_t chunk_ = 0;
+			size_t index_ = 0;
+		};
+
+		/* SnapshotTable::View:
+		*  An immutable, iterable snapshot of the table; any cql query accepts it.
+		*/
+		class View
+		{
+		public:
+			using value_type = TElement;
+			using const_iterator = typename SnapshotTable::const_iterator;
+			using iterator = const_iterator;
+
+			const_iterator begin() const { return const_iterator(&state_->chunks, 0); }
+			const_iterator end() const { return const_iterator(&state_->chunks, state_->chunks.size()); }
+			size_t size() const { return state_->size; }
+			bool empty() const { return state_->size == 0; }
+			uint64_t Version() const { return state_->version; }
+
+		private:
+			friend class SnapshotTable;
+			explicit View(std::shared_ptr<const State> state) : state_(std::move(state)) {}
+
+			std::shared_ptr<const State> state_;
+		};
+
+		SnapshotTable() : state_(std::make_shared<const State>()) {}
+
+		template<typename TContainer>
+		explicit SnapshotTable(const TContainer& container) : SnapshotTable()
+		{
+			InsertRange(container);
+		}
+
+		SnapshotTable(const SnapshotTable&) = delete;
+		SnapshotTable& operator=(const SnapshotTable&) = delete;
+
+		View Snapshot() const
+		{
+			std::lock_guard<std::mutex> lock(stateMutex_);
+			return View(state_);
+		}
+
+		size_t size() const { return Snapshot().size(); }
+
+		void Insert(const TElement& element)
+		{
+			InsertRange(IteratorRange<const TElement*>(&element, &element + 1));
+		}
+
+		template<typename TContainer>
+		void InsertRange(const TContainer& container)
+		{
+			std::lock_guard<std::mutex> writeLock(writeMutex_);
+			auto next = std::make_shared<State>(*Current());
+			auto first = std::begin(container);
+			auto last = std::end(container);
+			if (first == last)
+				return;
+
+			std::shared_ptr<Chunk> tail;
+			if (!next->chunks.empty() && next->chunks.back()->size() < ChunkSize)
+			{
+				tail = std::make_shared<Chunk>(*next->chunks.back());
+				next->chunks.back() = tail;
+			}
+			for (; first != last; ++first)
+			{
+				if (!tail || tail->size() == ChunkSize)
+				{
+					tail = std::make_shared<Chunk>();
+					tail->reserve(ChunkSize);
+					next->chunks.push_back(tail);
+				}
+				tail->push_back(*first);
+				next->size++;
+			}
+			Publish(std::move(next));
+		}
+
+		// Updates the rows matching the predicate, returns how many there were.
+		template<typename TFunc, typename TSetFunc>
+		size_t Update(const TFunc& predicate, const TSetFunc& setFunc)
+		{
+			std::lock_guard<std::mutex> writeLock(writeMutex_);
+			std::shared_ptr<State> next;
+			size_t updated = 0;
+			auto current = Current();
+			for (size_t i = 0; i < current->chunks.size(); i++)
+			{
+				const Chunk& chunk = *current->chunks[i];
+				std::shared_ptr<Chunk> copy;
+				for (size_t j = 0; j < chunk.size(); j++)
+				{
+					if (!predicate(chunk[j]))
+						continue;
+					if (!copy)
+						copy = std::make_shared<Chunk>(chunk);
+					setFunc((*copy)[j]);
+					updated++;
+				}
+				if (!copy)
+					continue;
+				if (!next)
+					next = std::make_shared<State>(*current);
+				next->chunks[i] = std::move(copy);
+			}
+			if (next)
+				Publish(std::move(next));
+			return updated;
+		}
+
+		// Deletes the rows matching the predicate, returns how many there were.
+		template<typename TFunc>
+		size_t Delete(const TFunc& predicate)
+		{
+			std::lock_guard<std::mutex> writeLock(writeMutex_);
+			auto current = Current();
+			auto next = std::make_shared<State>();
+			next->version = current->version;
+			next->chunks.reserve(current->chunks.size());
+			for (auto& chunk : current->chunks)
+			{
+				std::shared_ptr<Chunk> copy;
+				for (auto itr = chunk->begin(); itr != chunk->end(); ++itr)
+				{
+					if (!predicate(*itr))
+					{
+						if (copy)
+							copy->push_back(*itr);
+						continue;
+					}
+					if (!copy)
+						copy = std::make_shared<Chunk>(chunk->begin(), itr);
+				}
+				if (!copy)
+					next->chunks.push_back(chunk);
+				else if (!copy->empty())
+					next->chunks.push_back(std::move(copy));
+			}
+			for (auto& chunk : next->chunks)
+				next->size += chunk->size();
+
+			size_t removed = current->size - next->size;
+			if (removed > 0)
+				Publish(std::move(next));
+			return removed;
+		}
+
+	private:
+		std::shared_ptr<const State> Current() const
+		{
+			std::lock_guard<std::mutex> lock(stateMutex_);
+			return state_;
+		}
+
+		void Publish(std::shared_ptr<State> next)
+		{
+			next->version++;
+			std::shared_ptr<const State> previous;
+			std::lock_guard<std::mutex> lock(stateMutex_);
+			previous = std::exchange(state_, std::move(next));
+		}
+
+		mutable std::mutex stateMutex_;
+		std::mutex writeMutex_;
+		std::shared_ptr<const State> state_;
+	};
+
+	template<typename TElement, size_t ChunkSize, typename TFunc, typename TSetFunc>
+	void Update(SnapshotTable<TElement, ChunkSize>& table, const TFunc& predicate, const TSetFunc& setFunc)
+	{
+		table.Update(predicate, setFunc);
+	}
+
+	template<typename TElement, size_t ChunkSize, typename TFunc>
+	void Delete(SnapshotTable<TElement, ChunkSize>& table, const TFunc& predicate)
+	{
+		table.Delete(predicate);
+	}
+
+	/* ConcurrentAppendTable:
+	*  An append-only table that many threads can append to without locks while others
+	*  query it. Appends reserve a slot with one atomic increment, construct the row in
+	*  place in a fixed-size chunk (chunks are allocated on demand into a preallocated
+	*  directory, so rows never move) and then mark the slot ready. Snapshot() returns the
+	*  longest prefix of ready rows, which any cql query can scan while appends continue.
+	*  If a row's constructor throws, its slot is abandoned: readers skip it and the
+	*  prefix moves past it. Capacity is fixed at construction to maxChunks * ChunkSize rows.
+	*
+	*  Usage:
+	*  ConcurrentAppendTable<Event> events;
+	*  // producer threads
+	*  events.Append(event);
+	*  // reader threads
+	*  auto errors = Where(events.Snapshot(), [](const Event& e) { return e.level == Level::Error; });
+	*
+	*  Minimum C++ standard: C++17.
+	*/
+	template<typename TElement, size_t ChunkSize = 4096>
+	class ConcurrentAppendTable
+	{
+		static_assert(ChunkSize > 0, "cql::ConcurrentAppendTable: ChunkSize must be positive");
+
+		struct Chunk
+		{
+			alignas(TElement) unsigned char storage[ChunkSize * sizeof(TElement)];
+			std::atomic<bool> ready[ChunkSize] = {};
+
+			TElement* Slot(size_t index) { return reinterpret_cast<TElement*>(storage) + index; }
+		};
+
+	public:
+		class const_iterator
+		{
+		public:
+			using iterator_category = std::forward_iterator_tag;
+			using value_type = TElement;
+			using difference_type = std::ptrdiff_t;
+			using pointer = const TElement*;
+			using reference = const TElement&;
+
+			const_iterator() = default;
+
+			reference operator*() const { return *table_->At(index_); }
+			pointer operator->() const { return table_->At(index_); }
+			const_iterator& operator++() { index_++; SkipAbandoned(); return *this; }
+			const_iterator operator++(int) { const_iterator copy = *this; ++*this; return copy; }
+			bool operator==(const const_iterator& other) const { return index_ == other.index_; }
+			bool operator!=(const const_iterator& other) const { return index_ != other.index_; }
+
+		private:
+			friend class ConcurrentAppendTable;
+			const_iterator(const ConcurrentAppendTable* table, size_t index, const size_t* abandoned, const size_t* abandonedEnd)
+				: table_(table), index_(index), abandoned_(abandoned), abandonedEnd_(abandonedEnd)
+			{
+				SkipAbandoned();
+			}
+
+			void SkipAbandoned()
+			{
+				while (abandoned_ != abandonedEnd_ && *abandoned_ == index_)
+				{
+					index_++;
+					abandoned_++;
+				}
+			}
+
+			const ConcurrentAppendTable* table_ = nullptr;
+			size_t index_ = 0;
+			const size_t* abandoned_ = nullptr;
+			const size_t* abandonedEnd_ = nullptr;
+		};
+
+		/* ConcurrentAppendTable::View:
+		*  The rows committed when the view was taken; any cql query accepts it.
+		*/
+		class View
+		{
+		public:
+			using value_type = TElement;
+			using const_iterator = typename ConcurrentAppendTable::const_iterator;
+			using iterator = const_iterator;
+
+			const_iterator begin() const { return const_iterator(table_, 0, abandoned_.data(), abandoned_.data() + abandoned_.size()); }
+			const_iterator end() const { return const_iterator(table_, end_, nullptr, nullptr); }
+			size_t size() const { return end_ - abandoned_.size(); }
+			bool empty() const { return size() == 0; }
+
+		private:
+			friend class ConcurrentAppendTable;
+			View(const ConcurrentAppendTable* table, size_t end, std::vector<size_t> abandoned)
+				: table_(table), end_(end), abandoned_(std::move(abandoned)) {}
+
+			const ConcurrentAppendTable* table_;
+			size_t end_;
+			std::vector<size_t> abandoned_;
+		};
+
+		explicit ConcurrentAppendTable(size_t maxChunks = 1 << 16)
+			: chunks_(new std::atomic<Chunk*>[maxChunks]), maxChunks_(maxChunks)
+		{
+			for (size_t i = 0; i < maxChunks_; i++)
+				chunks_[i].store(nullptr, std::memory_order_relaxed);
+		}
+
+		ConcurrentAppendTable(const ConcurrentAppendTable&) = delete;
+		ConcurrentAppendTable& operator=(const ConcurrentAppendTable&) = delete;
+
+		~ConcurrentAppendTable()
+		{
+			for (size_t i = 0; i < maxChunks_; i++)
+			{
+				Chunk* chunk = chunks_[i].load(std::memory_order_acquire);
+				if (chunk == nullptr)
+					continue;
+				for (size_t j = 0; j < ChunkSize; j++)
+				{
+					if (chunk->ready[j].load(std::memory_order_acquire))
+						chunk->Slot(j)->~TElement();
+				}
+				delete chunk;
+			}
+		}
+
+		// Appends a row constructed from args and returns its index. Safe to call from any thread.
+		template<typename... TArgs>
+		size_t Emplace(TArgs&&... args)
+		{
+			size_t index = reserved_.fetch_add(1, std::memory_order_relaxed);
+			if (index >= maxChunks_ * ChunkSize)
+				throw std::length_error("cql::ConcurrentAppendTable: capacity exceeded");
+
+			try
+			{
+				Chunk* chunk = AcquireChunk(index / ChunkSize);
+				size_t slot = index % ChunkSize;
+				new (chunk->Slot(slot)) TElement(std::forward<TArgs>(args)...);
+				chunk->ready[slot].store(true);
+			}
+			catch (...)
+			{
+				Abandon(index);
+				throw;
+			}
+			AdvanceCommitted();
+			return index;
+		}
+
+		size_t Append(const TElement& element) { return Emplace(element); }
+		size_t Append(TElement&& element) { return Emplace(std::move(element)); }
+
+		// The rows appended so far without gaps; rows still being written are excluded.
+		View Snapshot() const
+		{
+			size_t committed = committed_.load();
+			if (!anyAbandoned_.load())
+				return View(this, committed, {});
+			std::lock_guard<std::mutex> lock(abandonedMutex_);
+			return View(this, committed, std::vector<size_t>(abandoned_.begin(), std::lower_bound(abandoned_.begin(), abandoned_.end(), committed)));
+		}
+
+		size_t size() const { return Snapshot().size(); }
+		size_t capacity() const { return maxChunks_ * ChunkSize; }
+
+	private:
+		const TElement* At(size_t index) const
+		{
+			return chunks_[index / ChunkSize].load(std::memory_order_acquire)->Slot(index % ChunkSize);
+		}
+
+		Chunk* AcquireChunk(size_t chunkIndex)
+		{
+			Chunk* chunk = chunks_[chunkIndex].load(std::memory_order_acquire);
+			if (chunk != nullptr)
+				return chunk;
+
+			std::unique_ptr<Chunk> created(new Chunk);
+			if (chunks_[chunkIndex].compare_exchange_strong(chunk, created.get(), std::memory_order_acq_rel, std::memory_order_acquire))
+				return created.release();
+			return chunk;
+		}
+
+		// Records a slot whose row could not be built, so the committed prefix can move past it.
+		void Abandon(size_t index)
+		{
+			{
+				std::lock_guard<std::mutex> lock(abandonedMutex_);
+				abandoned_.insert(std::upper_bound(abandoned_.begin(), abandoned_.end(), index), index);
+				anyAbandoned_.store(true);
+			}
+			AdvanceCommitted();
+		}
+
+		bool IsSettled(size_t index) const
+		{
+			if (index >= maxChunks_ * ChunkSize)
+				return false;
+			Chunk* chunk = chunks_[index / ChunkSize].load(std::memory_order_acquire);
+			if (chunk != nullptr && chunk->ready[index % ChunkSize].load())
+				return true;
+			if (!anyAbandoned_.load())
+				return false;
+			std::lock_guard<std::mutex> lock(abandonedMutex_);
+			return std::binary_search(abandoned_.begin(), abandoned_.end(), index);
+		}
+
+		// Moves the committed prefix over every ready or abandoned slot. Each appender helps
+		// after publishing its own slot, so the prefix never stalls behind a finished row.
+		void AdvanceCommitted()
+		{
+			size_t committed = committed_.load();
+			while (IsSettled(committed))
+			{
+				if (committed_.compare_exchange_weak(committed, committed + 1))
+					committed++;
+			}
+		}
+
+		std::unique_ptr<std::atomic<Chunk*>[]> chunks_;
+		size_t maxChunks_;
+		std::atomic<size_t> reserved_{ 0 };
+		std::atomic<size_t> committed_{ 0 };
+		mutable std::mutex abandonedMutex_;
+		std::vector<size_t> abandoned_;
+		std::atomic<bool> anyAbandoned_{ false };
+	};
+#endif
+
+#if (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+	template<template<typename...> typename TContainer, typename TElement, typename TFunc>
+	std::experimental::generator<TElement> WhereLazy(const TContainer<TElement>& container, const TFunc& predicate)
+	{
+		for (auto& element : container)
+		{
+			if (predicate(element))
+				co_yield(element);
+		}
+	}
+
+	template<template<typename...> typename TContainer, typename TElement>
+	std::experimental::generator<TElement> DistinctLazy(const TContainer<TElement>& container)
+	{
+		TContainer<TElement> result;
+		for (auto& element : container)
+		{
+			if (std::find(result.begin(), result.end(), element) == result.end())
+			{
+				result.push_back(element);
+				co_yield(element);
+			}
+		}
+	}
+#endif
+}
+
+#if ((defined(_MSVC_LANG) && _MSVC_LANG >= 201703L) || __cplusplus >= 201703L)
+namespace std
+{
+	template <typename TKey>
+	struct hash<cql::HashedKey<TKey>>
+	{
+		size_t operator()(const cql::HashedKey<TKey>& key) const { return key.hash; }
+	};
+
+	template <>
+	struct hash<cql::InternedString>
+	{
+		size_t operator()(cql::InternedString interned) const { return std::hash<uint32_t>{}(interned.id); }
+	};
+}
+#endif
 
 #endif // !CONTAINER_QUERY_LIBRARY
\ No newline at end of file
@@ -1,4 +1,14 @@
 #include "pch.h"
+#include <array>
+#include <deque>
+#include <forward_list>
+#include <sstream>
+#include <future>
+#include <set>
+#include <unordered_map>
+#if __has_include(<span>)
+#include <span>
+#endif
 
 
 TEST(ContainerQueryLibrary, Select) {
@@ -136,6 +146,53 @@ TEST(ContainerQueryLibrary, GroupBy) {
 	EXPECT_EQ(res[3][0].y, 9);
 }
 
+TEST(ContainerQueryLibrary, GroupByStringViewKey) {
+	struct Request { std::string url; int status; };
+	std::vector<Request> ls{ {"/a", 200}, {"/b", 404}, {"/a", 500} };
+	auto res = cql::GroupBy(ls, [](const Request& req) { return std::string_view(req.url); });
+	EXPECT_EQ(res.size(), 2);
+	EXPECT_EQ(res.find(std::string_view("/a"))->second.size(), 2);
+	EXPECT_EQ(res["/b"].front().status, 404);
+
+	auto hashed = cql::GroupBy(ls, [](const Request& req) { return cql::HashedKey<std::string_view>(req.url); });
+	EXPECT_EQ(hashed.size(), 2);
+	auto itr = hashed.find(cql::HashedKey<std::string_view>("/a"));
+	EXPECT_NE(itr, hashed.end());
+	EXPECT_EQ(itr->first.value, "/a");
+	EXPECT_EQ(itr->first.hash, cql::StringKeyHash{}("/a"));
+	EXPECT_EQ(itr->second.size(), 2);
+	EXPECT_EQ(std::hash<cql::HashedKey<std::string>>{}(itr->first), itr->first.hash);
+
+	static_assert(std::is_same<cql::FlatHashMap<std::string, int>::hasher, cql::StringKeyHash>::value, "string keys hash through StringKeyHash");
+	static_assert(std::is_same<cql::FlatHashSet<std::string_view>::hasher, cql::StringKeyHash>::value, "string keys hash through StringKeyHash");
+	cql::FlatHashMap<std::string, int> byUrl;
+	byUrl["/a"] = 1;
+	EXPECT_EQ(byUrl.hash_function()("/a"), cql::StringKeyHash{}(std::string("/a")));
+}
+
+TEST(ContainerQueryLibrary, GroupByCompact) {
+	struct MyStruct { int x, y; };
+	std::vector<MyStruct> ls{ {5,7} ,{3,9} ,{5,4}, {2,6} };
+	auto func = [](const MyStruct& myStruct) { return myStruct.x; };
+	auto res = cql::GroupByCompact(ls, func);
+	EXPECT_EQ(res.size(), 3);
+	EXPECT_EQ(res.Elements().size(), 4);
+
+	EXPECT_EQ(res.Key(0), 2);
+	EXPECT_EQ(res.Key(1), 3);
+	EXPECT_EQ(res.Key(2), 5);
+
+	EXPECT_EQ(res[5].size(), 2);
+	EXPECT_EQ(res[5][0].y, 7);
+	EXPECT_EQ(res[5][1].y, 4);
+
+	EXPECT_EQ(res[2].size(), 1);
+	EXPECT_EQ(res[2][0].y, 6);
+
+	EXPECT_TRUE(res[4].empty());
+	EXPECT_FALSE(res.Contains(4));
+}
+
 TEST(ContainerQueryLibrary, Join) {
 	struct MyStruct1 { int x, y; };
 	struct MyStruct2 { int w, z; };
@@ -161,3 +218,988 @@ TEST(ContainerQueryLibrary, Join) {
 
 }
 
+TEST(ContainerQueryLibrary, JoinStringViewKey) {
+	struct User { std::string name; int age; };
+	struct Order { std::string owner; int amount; };
+	std::vector<User> users{ {"ann", 30}, {"bob", 40} };
+	std::list<Order> orders{ {"bob", 5}, {"bob", 7}, {"eve", 1} };
+	auto res = cql::Join(users, orders,
+		[](const User& user) { return std::string_view(user.name); },
+		[](const Order& order) { return std::string_view(order.owner); });
+	EXPECT_EQ(res.size(), 1);
+	EXPECT_EQ(res["bob"].first.front().age, 40);
+	EXPECT_EQ(res["bob"].second.size(), 2);
+}
+
+TEST(ContainerQueryLibrary, StringInterner) {
+	struct Log { std::string url; int bytes; };
+	std::vector<Log> logs{ {"/index", 10}, {"/about", 20}, {"/index", 30}, {std::string(1000, 'x'), 40} };
+	cql::StringInterner pool(64);
+
+	auto res = cql::GroupBy(logs, [&pool](const Log& log) { return pool.Intern(log.url); });
+	EXPECT_EQ(res.size(), 3);
+	EXPECT_EQ(pool.size(), 3);
+	auto index = pool.Find("/index");
+	EXPECT_TRUE(index.has_value());
+	EXPECT_EQ(res[*index].size(), 2);
+	EXPECT_EQ(pool.Lookup(*index), "/index");
+	EXPECT_EQ(pool.Lookup(pool.Intern(std::string(1000, 'x'))).size(), 1000);
+	EXPECT_FALSE(pool.Find("/missing").has_value());
+
+	auto ids = cql::Distinct(cql::InternAll(logs, [](const Log& log) { return std::string_view(log.url); }, pool));
+	EXPECT_EQ(ids.size(), 3);
+
+	cql::StringInterner oversizedFirst(64);
+	std::vector<std::string> texts{ std::string(100, 'y'), "a", "bb", "ccc", std::string(20, 'z'), std::string(30, 'w'), "d" };
+	std::vector<cql::InternedString> interned;
+	for (auto& text : texts)
+		interned.push_back(oversizedFirst.Intern(text));
+	for (size_t i = 0; i < texts.size(); i++)
+	{
+		EXPECT_EQ(oversizedFirst.Lookup(interned[i]), texts[i]);
+		EXPECT_EQ(oversizedFirst.Intern(texts[i]), interned[i]);
+	}
+}
+
+TEST(ContainerQueryLibrary, RangeInputs) {
+	std::deque<int> dq{ 5,1,4,1,3 };
+	cql::OrderBy(dq, [](int l, int r) { return l < r; });
+	EXPECT_EQ(dq.front(), 1);
+	EXPECT_EQ(dq.back(), 5);
+	std::deque<int> distinctDq = cql::Distinct(dq);
+	EXPECT_EQ(distinctDq.size(), 4);
+
+	std::forward_list<int> fl{ 3,1,2 };
+	cql::OrderBy(fl, [](int l, int r) { return l < r; });
+	EXPECT_EQ(fl.front(), 1);
+
+	std::array<int, 6> arr{ 6,2,2,5,4,6 };
+	std::vector<int> evens = cql::Where(arr, [](int v) { return v % 2 == 0; });
+	EXPECT_EQ(evens.size(), 5);
+	std::vector<int> distinctArr = cql::Distinct(arr);
+	EXPECT_EQ(distinctArr.size(), 4);
+	cql::OrderBy(arr, [](int l, int r) { return l > r; });
+	EXPECT_EQ(arr[0], 6);
+	EXPECT_EQ(arr[5], 2);
+
+	int raw[]{ 1,2,3,4 };
+	auto groups = cql::GroupBy(raw, [](int v) { return v % 2; });
+	EXPECT_EQ(groups[0].size(), 2);
+	EXPECT_EQ(groups[1].size(), 2);
+}
+
+#if defined(__cpp_lib_span)
+TEST(ContainerQueryLibrary, SpanInputs) {
+	struct MyStruct { int x, y; };
+	std::vector<MyStruct> buffer{ {1,4} ,{3,4} ,{1,5}, {2,7} };
+	std::span<const MyStruct> view(buffer);
+
+	std::vector<MyStruct> res = cql::Where(view, [](const MyStruct& s) { return s.y == 4; });
+	EXPECT_EQ(res.size(), 2);
+
+	auto groups = cql::GroupBy(view, [](const MyStruct& s) { return s.x; });
+	EXPECT_EQ(groups.size(), 3);
+	EXPECT_EQ(groups[1].size(), 2);
+
+	std::list<MyStruct> other{ {7,1}, {8,3} };
+	auto joined = cql::Join(view, other, [](const MyStruct& s) { return s.x; }, [](const MyStruct& s) { return s.y; });
+	EXPECT_EQ(joined.size(), 2);
+	EXPECT_EQ(joined[1].first.size(), 2);
+	EXPECT_EQ(joined[3].second.front().x, 8);
+
+	std::span<MyStruct> mutableView(buffer);
+	cql::OrderBy(mutableView, [](const MyStruct& l, const MyStruct& r) { return l.y > r.y; });
+	EXPECT_EQ(buffer[0].y, 7);
+}
+#endif
+
+TEST(ContainerQueryLibrary, WhereRef) {
+	struct Record { int id; int size; int year; };
+	std::vector<Record> records{ {1, 50, 1990}, {2, 150, 1995}, {3, 200, 2010}, {4, 300, 1980} };
+	auto big = cql::WhereRef(records, [](const Record& r) { return r.size > 100; });
+	EXPECT_EQ(big.size(), 3);
+	EXPECT_EQ(&big[0].get(), &records[1]);
+
+	auto bigAndOld = cql::WhereRef(big, [](const Record& r) { return r.year < 2000; });
+	EXPECT_EQ(bigAndOld.size(), 2);
+	EXPECT_EQ(&bigAndOld[1].get(), &records[3]);
+
+	auto groups = cql::GroupBy(bigAndOld, [](const Record& r) { return r.year / 10; });
+	EXPECT_EQ(groups.size(), 2);
+	EXPECT_EQ(groups[198].front().get().id, 4);
+}
+
+TEST(ContainerQueryLibrary, WhereView) {
+	std::list<int> ls{ 1,2,3,4,5,6 };
+	auto evens = cql::WhereView(ls, [](const int& v) { return v % 2 == 0; });
+	auto big = cql::WhereView(evens, [](const int& v) { return v > 2; });
+	std::vector<int> res(big.begin(), big.end());
+	EXPECT_EQ(res.size(), 2);
+	EXPECT_EQ(res[0], 4);
+	EXPECT_EQ(res[1], 6);
+	EXPECT_EQ(&*evens.begin(), &*std::next(ls.begin()));
+
+	ls.push_back(8);
+	auto groups = cql::GroupBy(big, [](const int& v) { return v > 5; });
+	EXPECT_EQ(groups[true].size(), 2);
+	EXPECT_EQ(groups[false].size(), 1);
+}
+
+TEST(ContainerQueryLibrary, MappedTable) {
+	struct Trade { int64_t time; int32_t symbol; double price; };
+	std::vector<Trade> trades{ {1, 7, 10.5}, {2, 3, 11.0}, {3, 7, 9.5}, {4, 5, 1.0} };
+	const std::string path = "cql_mapped_table_test.bin";
+	cql::SaveTable(path, trades);
+	{
+		cql::MappedTable<Trade> table(path);
+		EXPECT_EQ(table.size(), 4);
+		EXPECT_EQ(table[2].price, 9.5);
+
+		auto bySymbol = cql::GroupBy(table, [](const Trade& t) { return t.symbol; });
+		EXPECT_EQ(bySymbol.size(), 3);
+		EXPECT_EQ(bySymbol[7].size(), 2);
+
+		std::vector<Trade> cheap = cql::Where(table, [](const Trade& t) { return t.price < 10.0; });
+		EXPECT_EQ(cheap.size(), 2);
+
+		cql::MappedTable<Trade> moved(std::move(table));
+		EXPECT_EQ(moved.size(), 4);
+		EXPECT_TRUE(table.empty());
+	}
+	std::remove(path.c_str());
+	EXPECT_THROW(cql::MappedTable<Trade>("cql_missing_table.bin"), std::system_error);
+}
+
+TEST(ContainerQueryLibrary, AggregateBy) {
+	struct MyStruct { int x, y; };
+	std::vector<MyStruct> ls{ {1,4} ,{3,4} ,{1,4}, {2,7}, {1,1} };
+	auto res = cql::AggregateBy(ls, [](const MyStruct& s) { return s.x; }, 0,
+		[](int sum, const MyStruct& s) { return sum + s.y; });
+	EXPECT_EQ(res.size(), 3);
+	EXPECT_EQ(res[1], 9);
+	EXPECT_EQ(res[2], 7);
+	EXPECT_EQ(res[3], 4);
+}
+
+TEST(ContainerQueryLibrary, DelimitedReader) {
+	std::istringstream input(
+		"path,status,bytes\r\n"
+		"/index,200,10\r\n"
+		"/about,500,20\n"
+		"\n"
+		"/index,500,30\n"
+		"\"/a,b\",500,\"4\"\"0\"\n"
+		"/index,200,50");
+	cql::DelimitedReader reader(input, ',', 16);
+	reader.Skip(1);
+	auto errors = cql::WhereView(reader, [](const cql::DelimitedRow& row) { return row[1] == "500"; });
+	auto res = cql::AggregateBy(errors, [](const cql::DelimitedRow& row) { return row[0]; }, std::string(),
+		[](std::string bytes, const cql::DelimitedRow& row) { return bytes + row.As<std::string>(2) + ";"; });
+	EXPECT_EQ(res.size(), 3);
+	EXPECT_EQ(res["/about"], "20;");
+	EXPECT_EQ(res["/index"], "30;");
+	EXPECT_EQ(res["/a,b"], "4\"0;");
+
+	std::istringstream numbers("1;2.5\n3;x\n");
+	cql::DelimitedReader numbersReader(numbers, ';');
+	EXPECT_TRUE(numbersReader.Next());
+	EXPECT_EQ(numbersReader.Row().As<int>(0), 1);
+	EXPECT_EQ(numbersReader.Row().As<double>(1), 2.5);
+	EXPECT_TRUE(numbersReader.Next());
+	EXPECT_THROW(numbersReader.Row().As<int>(1), std::invalid_argument);
+	EXPECT_FALSE(numbersReader.Next());
+}
+
+TEST(ContainerQueryLibrary, Serialization) {
+	struct Trade { int32_t symbol; double price; };
+	std::vector<Trade> trades{ {7, 1.5}, {3, 2.0}, {7, 3.5} };
+	auto groups = cql::GroupBy(trades, [](const Trade& t) { return t.symbol; });
+
+	std::vector<char> bytes = cql::Serialize(groups);
+	auto copy = cql::Deserialize<decltype(groups)>(bytes);
+	EXPECT_EQ(copy.size(), 2);
+	EXPECT_EQ(copy[7].size(), 2);
+	EXPECT_EQ(copy[7][1].price, 3.5);
+
+	auto views = cql::Deserialize<std::map<int32_t, cql::GroupView<Trade>>>(bytes);
+	EXPECT_EQ(views[7].size(), 2);
+	EXPECT_EQ(views[3][0].price, 2.0);
+	EXPECT_GE(reinterpret_cast<const char*>(views[3].begin()), bytes.data());
+	EXPECT_LT(reinterpret_cast<const char*>(views[3].begin()), bytes.data() + bytes.size());
+
+	std::map<std::string, std::list<std::string>> names{ {"a", {"x", "y"}}, {"b", {}} };
+	auto namesCopy = cql::Deserialize<decltype(names)>(cql::Serialize(names));
+	EXPECT_EQ(namesCopy, names);
+
+	auto compact = cql::GroupByCompact(trades, [](const Trade& t) { return t.symbol; });
+	auto compactCopy = cql::Deserialize<decltype(compact)>(cql::Serialize(compact));
+	EXPECT_EQ(compactCopy[7].size(), 2);
+
+	bytes.resize(bytes.size() - 1);
+	EXPECT_THROW(cql::Deserialize<decltype(groups)>(bytes), std::out_of_range);
+
+	std::vector<char> forged = cql::Serialize(std::vector<double>{ 1.0 });
+	uint64_t length = (uint64_t(1) << 61) + 1;
+	std::memcpy(forged.data(), &length, sizeof(length));
+	EXPECT_THROW(cql::Deserialize<std::vector<double>>(forged), std::out_of_range);
+	EXPECT_THROW(cql::Deserialize<cql::GroupView<double>>(forged), std::out_of_range);
+
+	std::deque<int> chunked;
+	for (int i = 0; i < 5000; i++)
+		chunked.push_back(i);
+	std::vector<char> dequeBytes = cql::Serialize(chunked);
+	EXPECT_EQ(cql::Deserialize<std::deque<int>>(dequeBytes), chunked);
+	EXPECT_EQ(cql::Deserialize<std::vector<int>>(dequeBytes), std::vector<int>(chunked.begin(), chunked.end()));
+	EXPECT_EQ(cql::Serialize(std::vector<int>(chunked.begin(), chunked.end())), dequeBytes);
+}
+
+TEST(ContainerQueryLibrary, MergeGroups) {
+	std::vector<int> shard1{ 1,2,3 };
+	std::vector<int> shard2{ 4,5 };
+	auto parity = [](int v) { return v % 2; };
+	auto total = cql::GroupBy(shard1, parity);
+	cql::MergeGroups(total, cql::GroupBy(shard2, parity));
+	EXPECT_EQ(total[0].size(), 2);
+	EXPECT_EQ(total[1].size(), 3);
+	auto extra = cql::GroupBy(shard2, parity);
+	cql::MergeGroups(total, extra);
+	EXPECT_EQ(extra[0].size(), 1);
+	EXPECT_EQ(total[0].size(), 3);
+
+	auto add = [](int sum, int v) { return sum + v; };
+	auto sums = cql::AggregateBy(shard1, parity, 0, add);
+	cql::MergeGroups(sums, cql::AggregateBy(shard2, parity, 0, add), [](int l, int r) { return l + r; });
+	EXPECT_EQ(sums[0], 6);
+	EXPECT_EQ(sums[1], 9);
+
+	auto joined = cql::Join(shard1, shard1, parity, parity);
+	cql::MergeGroups(joined, cql::Join(shard2, shard2, parity, parity));
+	EXPECT_EQ(joined[0].first.size(), 2);
+	EXPECT_EQ(joined[1].second.size(), 3);
+}
+
+#if !defined(_WIN32)
+TEST(ContainerQueryLibrary, ShardPool) {
+	struct Trade { int32_t symbol; double price; };
+	auto pool = cql::MakeShardPool(4, [](size_t shard, size_t shards)
+	{
+		std::vector<Trade> trades;
+		for (size_t i = shard; i < 1000; i += shards)
+			trades.push_back({ int32_t(i % 7), 1.0 });
+		return trades;
+	});
+	EXPECT_EQ(pool.size(), 4);
+
+	auto sumBySymbol = [](const std::vector<Trade>& shard)
+	{
+		return cql::AggregateBy(shard, [](const Trade& t) { return t.symbol; }, 0.0,
+			[](double sum, const Trade& t) { return sum + t.price; });
+	};
+	auto addSums = [](auto& total, auto&& partial) { cql::MergeGroups(total, partial, std::plus<double>()); };
+	auto sums = pool.ScatterGather(sumBySymbol, addSums);
+	EXPECT_EQ(sums.size(), 7);
+	EXPECT_EQ(sums[0], 143.0);
+	EXPECT_EQ(sums[6], 142.0);
+
+	auto counts = pool.ScatterGather([](const std::vector<Trade>& shard, const int32_t& minSymbol)
+	{
+		return cql::CountBy(cql::Where(shard, [&](const Trade& t) { return t.symbol >= minSymbol; }), [](const Trade& t) { return t.symbol; });
+	}, int32_t(5), [](auto& total, auto&& partial) { cql::MergeGroups(total, partial, std::plus<size_t>()); });
+	EXPECT_EQ(counts.size(), 2);
+	EXPECT_EQ(counts[6], 142);
+
+	EXPECT_THROW(pool.ScatterGather([](const std::vector<Trade>&) -> std::vector<int> { throw std::runtime_error("boom"); }), std::runtime_error);
+	EXPECT_EQ(pool.ScatterGather(sumBySymbol, addSums)[0], 143.0);
+
+	auto numbers = cql::MakeShardPool(3, [](size_t shard, size_t shards)
+	{
+		std::list<int> values;
+		for (size_t v = 1 + 10 * shard / shards; v <= 10 * (shard + 1) / shards; v++)
+			values.push_back(int(v));
+		return values;
+	});
+	auto evens = numbers.ScatterGather([](const std::list<int>& shard) { return cql::Where(shard, [](int v) { return v % 2 == 0; }); });
+	EXPECT_EQ(evens, (std::list<int>{ 2,4,6,8,10 }));
+	auto groups = numbers.ScatterGather([](const std::list<int>& shard) { return cql::GroupBy(shard, [](int v) { return v % 3; }); });
+	EXPECT_EQ(groups[0], (std::list<int>{ 3,6,9 }));
+
+	EXPECT_THROW(cql::MakeShardPool(2, [](size_t shard, size_t) -> std::vector<int> { if (shard == 1) throw std::runtime_error("boom"); return {}; }), std::runtime_error);
+
+	std::promise<void> release;
+	std::thread running([future = release.get_future()]() mutable { future.wait(); });
+	EXPECT_THROW(cql::MakeShardPool(2, [](size_t, size_t) { return std::vector<int>(); }), std::logic_error);
+	release.set_value();
+	running.join();
+}
+#endif
+
+TEST(ContainerQueryLibrary, SharedMemory) {
+	struct Trade { int32_t symbol; double price; };
+	const std::string name = "/cql_shared_memory_test";
+	cql::SharedMemorySegment::Remove(name);
+	{
+		auto segment = cql::SharedMemorySegment::Create(name, 1 << 16);
+		auto* trades = segment.Construct<cql::SharedVector<Trade>>("trades", segment, 100);
+		trades->assign(std::vector<Trade>{ {7, 1.5}, {3, 2.0}, {7, 3.5}, {5, 4.0} });
+		segment.Construct<cql::SharedIndex<int32_t>>("bySymbol", segment, *trades, [](const Trade& t) { return t.symbol; });
+
+		auto reader = cql::SharedMemorySegment::Open(name);
+		EXPECT_NE(reader.data(), segment.data());
+		try
+		{
+			cql::SharedMemorySegment::Create(name, 1 << 16);
+			ADD_FAILURE() << "Create replaced a live segment";
+		}
+		catch (const std::system_error& error)
+		{
+			EXPECT_EQ(error.code(), std::errc::file_exists);
+		}
+		auto* shared = reader.Find<cql::SharedVector<Trade>>("trades");
+		EXPECT_NE(shared, nullptr);
+		EXPECT_EQ(shared->size(), 4);
+
+		std::vector<Trade> res = cql::Where(*shared, [](const Trade& t) { return t.price > 1.8; });
+		EXPECT_EQ(res.size(), 3);
+		auto groups = cql::GroupBy(*shared, [](const Trade& t) { return t.symbol; });
+		EXPECT_EQ(groups[7].size(), 2);
+
+		auto* index = reader.Find<cql::SharedIndex<int32_t>>("bySymbol");
+		auto positions = index->Find(7);
+		EXPECT_EQ(positions.size(), 2);
+		EXPECT_EQ((*shared)[positions.begin()->position].price, 1.5);
+		EXPECT_TRUE(index->Find(4).empty());
+		EXPECT_EQ(reader.Find<cql::SharedVector<Trade>>("missing"), nullptr);
+
+		(*trades)[0].price = 9.0;
+		EXPECT_EQ((*shared)[0].price, 9.0);
+		EXPECT_THROW(shared->assign(std::vector<Trade>(101)), std::length_error);
+	}
+	cql::SharedMemorySegment::Remove(name);
+	EXPECT_THROW(cql::SharedMemorySegment::Open(name), std::system_error);
+}
+
+TEST(ContainerQueryLibrary, Cancellation) {
+	std::vector<int> ls(100000);
+	for (int i = 0; i < 100000; i++)
+		ls[i] = 100000 - i;
+	auto parity = [](int v) { return v % 2; };
+
+	cql::CancellationToken token;
+	auto res = cql::GroupBy(ls, parity, token);
+	EXPECT_EQ(res[0].size(), 50000);
+
+	token.Cancel();
+	EXPECT_THROW(cql::GroupBy(ls, parity, token), cql::OperationCanceled);
+	EXPECT_THROW(cql::Join(ls, ls, parity, parity, token), cql::OperationCanceled);
+
+	cql::CancellationToken expired;
+	expired.CancelAfter(std::chrono::milliseconds(-1));
+	EXPECT_TRUE(expired.IsCanceled());
+	EXPECT_THROW(cql::OrderBy(ls, [](int l, int r) { return l < r; }, expired), cql::OperationCanceled);
+	EXPECT_EQ(ls.size(), 100000);
+
+	cql::CancellationToken slowToken;
+	EXPECT_THROW(cql::OrderBy(ls, [&slowToken](int l, int r) { slowToken.Cancel(); return l < r; }, slowToken), cql::OperationCanceled);
+}
+
+TEST(ContainerQueryLibrary, RunAsync) {
+	std::vector<int> ls{ 1,2,3,4,5 };
+	auto task = cql::GroupByAsync(ls, [](int v) { return v % 2; });
+	auto res = task.Get();
+	EXPECT_EQ(res[1].size(), 3);
+
+	std::list<int> other{ 5,1 };
+	cql::CancellationToken token;
+	token.Cancel();
+	auto canceled = cql::JoinAsync(ls, other, [](int v) { return v; }, [](int v) { return v; }, token);
+	EXPECT_THROW(canceled.Get(), cql::OperationCanceled);
+
+	std::vector<std::function<void()>> queue;
+	auto queued = cql::RunAsync([&ls]() { return cql::Where(ls, [](int v) { return v > 3; }); },
+		[&queue](std::function<void()> work) { queue.push_back(std::move(work)); });
+	EXPECT_FALSE(queued.IsReady());
+	queue.front()();
+	EXPECT_EQ(queued.Get().size(), 2);
+
+	auto sorted = cql::OrderByAsync(ls, [](int l, int r) { return l > r; });
+	sorted.Get();
+	EXPECT_EQ(ls.front(), 5);
+}
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+namespace
+{
+	struct DetachedCoroutine
+	{
+		struct promise_type
+		{
+			DetachedCoroutine get_return_object() { return {}; }
+			std::suspend_never initial_suspend() { return {}; }
+			std::suspend_never final_suspend() noexcept { return {}; }
+			void return_void() {}
+			void unhandled_exception() { std::terminate(); }
+		};
+	};
+
+	DetachedCoroutine AwaitGroupBy(const std::vector<int>& ls, std::promise<size_t>& groups)
+	{
+		auto res = co_await cql::GroupByAsync(ls, [](int v) { return v % 3; });
+		groups.set_value(res.size());
+	}
+}
+
+TEST(ContainerQueryLibrary, CoAwaitQuery) {
+	std::vector<int> ls{ 1,2,3,4,5,6,7 };
+	std::promise<size_t> groups;
+	auto result = groups.get_future();
+	AwaitGroupBy(ls, groups);
+	EXPECT_EQ(result.get(), 3);
+}
+#endif
+
+TEST(ContainerQueryLibrary, ProgressReporting) {
+	std::vector<int> ls(10000);
+	for (int i = 0; i < 10000; i++)
+		ls[i] = 10000 - i;
+
+	std::vector<cql::QueryProgress> reports;
+	auto monitor = cql::QueryMonitor().OnProgress([&reports](const cql::QueryProgress& p) { reports.push_back(p); }, 1000);
+	auto res = cql::Join(ls, ls, [](int v) { return v % 10; }, [](int v) { return v % 10; }, monitor);
+	EXPECT_EQ(res.size(), 10);
+	EXPECT_EQ(std::string(reports.front().phase), "Join: grouping first");
+	EXPECT_EQ(reports.front().processed, 0);
+	EXPECT_EQ(std::string(reports.back().phase), "Join: matching");
+	EXPECT_EQ(reports.back().processed, reports.back().total);
+	EXPECT_EQ(reports.back().total, 10);
+	auto mid = std::find_if(reports.begin(), reports.end(), [](const cql::QueryProgress& p) { return p.processed == 5000; });
+	EXPECT_NE(mid, reports.end());
+	EXPECT_EQ(mid->total, 10000);
+
+	reports.clear();
+	cql::CancellationToken token;
+	auto cancelling = cql::QueryMonitor()
+		.OnProgress([&token](const cql::QueryProgress& p) { if (p.processed >= 2000) token.Cancel(); }, 1000)
+		.WithCancellation(token);
+	EXPECT_THROW(cql::OrderBy(ls, [](int l, int r) { return l < r; }, cancelling), cql::OperationCanceled);
+
+	auto task = cql::GroupByAsync(ls, [](int v) { return v % 2; }, cql::QueryMonitor().OnProgress([&reports](const cql::QueryProgress& p) { reports.push_back(p); }));
+	EXPECT_EQ(task.Get().size(), 2);
+	EXPECT_EQ(reports.back().processed, 10000);
+
+	reports.clear();
+	std::forward_list<int> single(ls.begin(), ls.end());
+	EXPECT_EQ(cql::GroupBy(single, [](int v) { return v % 3; }, monitor).size(), 3);
+	EXPECT_EQ(reports.front().total, cql::QueryProgress::UnknownTotal);
+	EXPECT_EQ(reports[1].processed, 1000);
+	EXPECT_EQ(reports.back().processed, 10000);
+	EXPECT_EQ(reports.back().total, 10000);
+}
+
+TEST(ContainerQueryLibrary, QueryCache) {
+	struct Employee { std::string department; int salary; };
+	cql::VersionedContainer<std::vector<Employee>> employees(std::vector<Employee>{ {"a", 10}, {"b", 20}, {"a", 30} });
+	cql::QueryCache cache;
+	int computed = 0;
+	auto salaryByDepartment = [&computed](const std::vector<Employee>& e)
+	{
+		computed++;
+		return cql::AggregateBy(e, [](const Employee& x) { return x.department; }, 0, [](int sum, const Employee& x) { return sum + x.salary; });
+	};
+
+	auto res1 = cache.GetOrCompute("salary", employees, salaryByDepartment);
+	auto res2 = cache.GetOrCompute("salary", employees, salaryByDepartment);
+	EXPECT_EQ(computed, 1);
+	EXPECT_EQ(res1, res2);
+	EXPECT_EQ(res1->at("a"), 40);
+
+	cql::Update(employees, [](const Employee& e) { return e.department == "x"; }, [](Employee& e) { e.salary = 0; });
+	EXPECT_EQ(employees.Version(), 0);
+	cql::Update(employees, [](Employee& e) { e.salary += 1; });
+	auto res3 = cache.GetOrCompute("salary", employees, salaryByDepartment);
+	EXPECT_EQ(computed, 2);
+	EXPECT_EQ(res3->at("a"), 42);
+	EXPECT_EQ(res1->at("a"), 40);
+
+	employees.Insert({ "c", 5 });
+	cql::Delete(employees, [](const Employee& e) { return e.department == "b"; });
+	EXPECT_EQ(employees.Version(), 3);
+	auto res4 = cache.GetOrCompute("salary", employees, salaryByDepartment);
+	EXPECT_EQ(res4->count("b"), 0);
+	EXPECT_EQ(res4->at("c"), 5);
+
+	cql::VersionedContainer<std::list<int>> ids(std::list<int>{ 1, 2 });
+	auto count = cache.GetOrCompute("join", employees, ids, [](const auto& e, const auto& i) { return e.size() + i.size(); });
+	EXPECT_EQ(*count, 5);
+	EXPECT_EQ(cache.size(), 2);
+	cache.Invalidate(ids);
+	EXPECT_EQ(cache.size(), 1);
+	EXPECT_THROW(cache.GetOrCompute("salary", employees, [](const auto&) { return 0; }), std::logic_error);
+
+	{
+		cql::VersionedContainer<std::vector<int>> temporary(std::vector<int>{ 1, 2, 3 });
+		cache.GetOrCompute("size", temporary, [](const auto& t) { return t.size(); });
+		cache.GetOrCompute("join", employees, temporary, [](const auto& e, const auto& t) { return e.size() + t.size(); });
+		EXPECT_EQ(cache.size(), 3);
+	}
+	EXPECT_EQ(cache.size(), 1);
+
+	cql::VersionedContainer<std::vector<int>> outlived(std::vector<int>{ 1 });
+	{
+		cql::QueryCache shortLived;
+		shortLived.GetOrCompute("size", outlived, [](const auto& o) { return o.size(); });
+	}
+}
+
+TEST(ContainerQueryLibrary, MaterializedAggregate) {
+	struct Event { std::string host; int bytes; };
+	cql::VersionedContainer<std::vector<Event>> events(std::vector<Event>{ {"a", 10}, {"b", 20} });
+	cql::MaterializedAggregate bytesByHost(events, [](const Event& e) { return e.host; }, [](const Event& e) { return e.bytes; });
+	EXPECT_EQ(bytesByHost.Sum("a"), 10);
+
+	events.Insert({ "a", 30 });
+	EXPECT_EQ(bytesByHost.Sum("a"), 40);
+	EXPECT_EQ(bytesByHost.Count("a"), 2);
+	EXPECT_EQ(bytesByHost.Average("a"), 20.0);
+
+	cql::Update(events, [](const Event& e) { return e.bytes == 20; }, [](Event& e) { e.host = "a"; e.bytes = 5; });
+	EXPECT_EQ(bytesByHost.Sum("a"), 45);
+	EXPECT_EQ(bytesByHost.Count("b"), 0);
+	EXPECT_EQ(bytesByHost.size(), 1);
+
+	cql::Delete(events, [](const Event& e) { return e.bytes >= 30; });
+	EXPECT_EQ(bytesByHost.Sum("a"), 15);
+
+	events.Modify([](std::vector<Event>& e) { e.push_back({ "c", 7 }); });
+	EXPECT_EQ(bytesByHost.Sum("c"), 7);
+
+	auto expected = cql::AggregateBy(events.Get(), [](const Event& e) { return e.host; }, 0, [](int sum, const Event& e) { return sum + e.bytes; });
+	EXPECT_EQ(expected.size(), bytesByHost.size());
+	for (auto& elem : expected)
+		EXPECT_EQ(bytesByHost.Sum(elem.first), elem.second);
+
+	int tested = 0;
+	cql::Delete(events, [&tested](const Event& e) { tested++; return e.bytes == 7; });
+	EXPECT_EQ(tested, 3);
+	EXPECT_EQ(bytesByHost.Count("c"), 0);
+
+	const std::string longHost(40, 'h');
+	cql::VersionedContainer<std::vector<Event>> hosts(std::vector<Event>{ {longHost + "1", 1}, {longHost + "2", 2} });
+	cql::MaterializedAggregate byHostView(hosts, [](const Event& e) { return std::string_view(e.host); }, [](const Event& e) { return e.bytes; });
+	static_assert(std::is_same<decltype(byHostView)::KeyType, std::string>::value, "string_view keys are stored as std::string");
+	cql::Update(hosts, [](const Event& e) { return e.bytes == 1; }, [&longHost](Event& e) { e.host = longHost + "3"; });
+	cql::Delete(hosts, [](const Event& e) { return e.bytes == 2; });
+	hosts.Insert({ longHost + "3", 4 });
+	EXPECT_EQ(byHostView.size(), 1);
+	EXPECT_EQ(byHostView.Sum(longHost + "3"), 5);
+	hosts.Modify([&longHost](std::vector<Event>& e) { e.clear(); e.push_back({ longHost + "4", 8 }); });
+	EXPECT_EQ(byHostView.Sum(longHost + "4"), 8);
+	EXPECT_EQ(byHostView.Results().begin()->first, longHost + "4");
+
+	cql::VersionedContainer<std::set<int>> values(std::set<int>{ 1, 2, 3 });
+	cql::MaterializedAggregate byParity(values, [](int v) { return v % 2; }, [](int v) { return v; });
+	cql::Update(values, [](int v) { return v < 3; }, [](int& v) { v += 10; });
+	EXPECT_EQ(values.Get(), (std::set<int>{ 3, 11, 12 }));
+	EXPECT_EQ(byParity.Sum(1), 14);
+	EXPECT_EQ(byParity.Sum(0), 12);
+	cql::Update(values, [](int v) { return v == 3; }, [](int& v) { v = 11; });
+	EXPECT_EQ(values.size(), 2);
+	EXPECT_EQ(byParity.Sum(1), 11);
+	EXPECT_EQ(byParity.Count(1), 1);
+}
+
+TEST(ContainerQueryLibrary, IncrementalDistinctAndJoin) {
+	cql::IncrementalDistinct<int> distinct;
+	EXPECT_EQ(distinct.Add(std::vector<int>{ 3, 1, 3 }), (std::vector<int>{ 3, 1 }));
+	EXPECT_EQ(distinct.Add(std::list<int>{ 1, 2, 2, 4 }), (std::vector<int>{ 2, 4 }));
+	EXPECT_EQ(distinct.size(), 4);
+
+	struct Order { int id; int amount; };
+	struct Payment { int orderId; int paid; };
+	auto join = cql::MakeIncrementalJoin<Order, Payment>([](const Order& o) { return o.id; }, [](const Payment& p) { return p.orderId; });
+	EXPECT_TRUE(join.AddFirst(std::vector<Order>{ {1, 10}, {2, 20} }).empty());
+
+	auto matched = join.AddSecond(std::vector<Payment>{ {1, 5}, {3, 7} });
+	ASSERT_EQ(matched.size(), 1);
+	EXPECT_EQ(matched[0].first.amount, 10);
+	EXPECT_EQ(matched[0].second.paid, 5);
+
+	matched = join.AddFirst(std::vector<Order>{ {3, 30}, {1, 11} });
+	ASSERT_EQ(matched.size(), 2);
+	EXPECT_EQ(matched[0].second.paid, 7);
+	EXPECT_EQ(matched[1].first.amount, 11);
+	EXPECT_EQ(join.KeyCount(), 3);
+
+	struct User { std::string name; };
+	auto byName = cql::MakeIncrementalJoin<User, User>([](const User& u) { return std::string_view(u.name); }, [](const User& u) { return std::string_view(u.name); });
+	byName.AddFirst(std::vector<User>{ {"ann"}, {"bob"} });
+	EXPECT_EQ(byName.AddSecond(std::vector<User>{ {"bob"}, {"cid"}, {"bob"} }).size(), 2);
+	EXPECT_EQ(byName.KeyCount(), 3);
+}
+
+TEST(ContainerQueryLibrary, SnapshotTable) {
+	cql::SnapshotTable<int, 4> table(std::vector<int>(10, 0));
+	auto before = table.Snapshot();
+
+	std::atomic<bool> done{ false };
+	std::atomic<int> inconsistent{ 0 };
+	std::thread reader([&] {
+		while (!done)
+		{
+			auto snapshot = table.Snapshot();
+			auto groups = cql::GroupBy(snapshot, [](int x) { return x; });
+			if (groups.size() != 1 || groups.begin()->second.size() != snapshot.size())
+				inconsistent++;
+		}
+	});
+	for (int i = 0; i < 200; i++)
+		cql::Update(table, [](int) { return true; }, [](int& x) { x++; });
+	done = true;
+	reader.join();
+
+	EXPECT_EQ(inconsistent, 0);
+	EXPECT_EQ(cql::Where(before, [](int x) { return x == 0; }).size(), 10);
+	EXPECT_EQ(table.Snapshot().Version(), before.Version() + 200);
+
+	table.Insert(7);
+	cql::Delete(table, [](int x) { return x == 200; });
+	auto after = table.Snapshot();
+	EXPECT_EQ(std::vector<int>(after.begin(), after.end()), std::vector<int>{ 7 });
+	EXPECT_EQ(before.size(), 10);
+
+	cql::SnapshotTable<int, 4> counted(std::vector<int>{ 1, 2, 3, 4, 5, 6 });
+	int tested = 0;
+	EXPECT_EQ(counted.Update([&tested](int x) { tested++; return x % 2 == 0; }, [](int& x) { x *= 10; }), 3);
+	EXPECT_EQ(tested, 6);
+	tested = 0;
+	EXPECT_EQ(counted.Delete([&tested](int x) { tested++; return x > 30; }), 2);
+	EXPECT_EQ(tested, 6);
+	auto remaining = counted.Snapshot();
+	EXPECT_EQ(std::vector<int>(remaining.begin(), remaining.end()), (std::vector<int>{ 1, 20, 3, 5 }));
+}
+
+TEST(ContainerQueryLibrary, ConcurrentAppendTable) {
+	cql::ConcurrentAppendTable<std::pair<int, int>, 64> events(256);
+	const int producers = 4;
+	const int perProducer = 2000;
+
+	std::atomic<bool> done{ false };
+	std::atomic<int> broken{ 0 };
+	std::thread reader([&] {
+		size_t last = 0;
+		while (!done)
+		{
+			auto snapshot = events.Snapshot();
+			if (snapshot.size() < last)
+				broken++;
+			last = snapshot.size();
+			auto invalid = cql::Where(snapshot, [](const std::pair<int, int>& e) { return e.second < 0 || e.second >= perProducer; });
+			broken += static_cast<int>(invalid.size());
+		}
+	});
+
+	std::vector<std::thread> threads;
+	for (int p = 0; p < producers; p++)
+		threads.emplace_back([&events, p] {
+			for (int i = 0; i < perProducer; i++)
+				events.Append({ p, i });
+		});
+	for (auto& thread : threads)
+		thread.join();
+	done = true;
+	reader.join();
+
+	EXPECT_EQ(broken, 0);
+	ASSERT_EQ(events.size(), producers * perProducer);
+	auto byProducer = cql::GroupBy(events.Snapshot(), [](const std::pair<int, int>& e) { return e.first; });
+	for (auto& group : byProducer)
+		EXPECT_EQ(group.second.size(), perProducer);
+
+	cql::ConcurrentAppendTable<int, 4> tiny(1);
+	for (int i = 0; i < 4; i++)
+		tiny.Append(i);
+	EXPECT_THROW(tiny.Append(4), std::length_error);
+
+	struct Fragile
+	{
+		explicit Fragile(int v) : value(v) { if (v < 0) throw std::invalid_argument("negative"); }
+		int value;
+	};
+	cql::ConcurrentAppendTable<Fragile, 4> fragile(4);
+	fragile.Emplace(1);
+	EXPECT_THROW(fragile.Emplace(-1), std::invalid_argument);
+	fragile.Emplace(2);
+	EXPECT_THROW(fragile.Emplace(-2), std::invalid_argument);
+	EXPECT_EQ(fragile.size(), 2);
+	auto rows = fragile.Snapshot();
+	std::vector<int> values;
+	for (auto& row : rows)
+		values.push_back(row.value);
+	EXPECT_EQ(values, (std::vector<int>{ 1, 2 }));
+	EXPECT_EQ(cql::Where(rows, [](const Fragile& f) { return f.value > 1; }).size(), 1);
+}
+
+TEST(ContainerQueryLibrary, Merge) {
+	struct Stock { int sku; int count; };
+	auto sku = [](const Stock& s) { return s.sku; };
+	auto add = [](Stock& row, const Stock& in) { row.count += in.count; };
+	auto copy = [](const Stock& in) { return in; };
+
+	std::vector<Stock> stock{ {1, 5}, {2, 0}, {4, 1} };
+	auto result = cql::Merge(stock, std::list<Stock>{ {2, 10}, {3, 4}, {3, 1} }, sku, add, copy);
+	EXPECT_EQ(result.matched, 1);
+	EXPECT_EQ(result.inserted, 1);
+	EXPECT_EQ(result.deleted, 0);
+	ASSERT_EQ(stock.size(), 4);
+	EXPECT_EQ(stock[1].count, 10);
+	EXPECT_EQ(stock[3].sku, 3);
+	EXPECT_EQ(stock[3].count, 5);
+
+	std::list<Stock> ls{ {1, 1}, {2, 2}, {2, 3}, {5, 5} };
+	result = cql::Merge(ls, std::vector<Stock>{ {2, 1}, {6, 6} }, sku, add, copy, true);
+	EXPECT_EQ(result.matched, 2);
+	EXPECT_EQ(result.inserted, 1);
+	EXPECT_EQ(result.deleted, 2);
+	auto counts = cql::Select(ls, [](const Stock& s) { return s.count; });
+	EXPECT_EQ(std::vector<int>(counts.begin(), counts.end()), (std::vector<int>{ 3, 4, 6 }));
+
+	std::vector<Stock> renamed{ {1, 1}, {2, 2}, {3, 3} };
+	result = cql::Merge(renamed, std::vector<Stock>{ {2, 0} }, sku, [](Stock& row, const Stock&) { row.sku = 7; }, copy, true);
+	EXPECT_EQ(result.matched, 1);
+	EXPECT_EQ(result.deleted, 2);
+	ASSERT_EQ(renamed.size(), 1);
+	EXPECT_EQ(renamed[0].sku, 7);
+	EXPECT_EQ(renamed[0].count, 2);
+
+	struct Named { std::string name; int count; };
+	std::vector<Named> named{ {"apple", 1}, {"pear", 2} };
+	result = cql::Merge(named, std::vector<Named>{ {"pear", 3}, {"plum", 4}, {"plum", 5} },
+		[](const Named& n) { return std::string_view(n.name); },
+		[](Named& row, const Named& in) { row.count += in.count; },
+		[](const Named& in) { return in; });
+	EXPECT_EQ(result.matched, 1);
+	EXPECT_EQ(result.inserted, 1);
+	ASSERT_EQ(named.size(), 3);
+	EXPECT_EQ(named[1].count, 5);
+	EXPECT_EQ(named[2].name, "plum");
+	EXPECT_EQ(named[2].count, 9);
+}
+
+TEST(ContainerQueryLibrary, WhereKeyIn) {
+	struct Row { int id; int value; };
+	auto id = [](const Row& r) { return r.id; };
+
+	std::vector<Row> sorted{ {1, 0}, {2, 0}, {2, 0}, {5, 0}, {9, 0} };
+	EXPECT_EQ(cql::UpdateWhereKeyIn(sorted, id, std::vector<int>{ 2, 3, 9 }, [](Row& r) { r.value = 1; }), 3);
+	EXPECT_EQ(cql::Where(sorted, [](const Row& r) { return r.value == 1; }).size(), 3);
+	EXPECT_EQ(cql::DeleteWhereKeyIn(sorted, id, std::vector<int>{ 1, 2, 7 }), 3);
+	ASSERT_EQ(sorted.size(), 2);
+	EXPECT_EQ(sorted[0].id, 5);
+
+	std::list<Row> unsorted{ {7, 0}, {3, 0}, {8, 0}, {3, 0} };
+	EXPECT_EQ(cql::DeleteWhereKeyIn(unsorted, id, std::list<int>{ 8, 3 }), 3);
+	ASSERT_EQ(unsorted.size(), 1);
+	EXPECT_EQ(unsorted.front().id, 7);
+	EXPECT_EQ(cql::UpdateWhereKeyIn(unsorted, id, std::vector<int>{}, [](Row& r) { r.value = 1; }), 0);
+
+	std::deque<Row> many;
+	for (int i = 0; i < 100; i++)
+		many.push_back({ (i * 37) % 100, i });
+	EXPECT_EQ(cql::DeleteWhereKeyIn(many, id, std::vector<int>{ 90, 3, 50, 77 }), 4);
+	ASSERT_EQ(many.size(), 96);
+	for (size_t i = 1; i < many.size(); i++)
+		EXPECT_LT(many[i - 1].value, many[i].value);
+
+	struct Tagged { std::string tag; };
+	std::vector<Tagged> tagged{ {"x"}, {"b"}, {"y"}, {"a"} };
+	EXPECT_EQ(cql::DeleteWhereKeyIn(tagged, [](const Tagged& t) { return std::string_view(t.tag); }, std::vector<std::string>{ "y", "b" }), 2);
+	ASSERT_EQ(tagged.size(), 2);
+	EXPECT_EQ(tagged[1].tag, "a");
+}
+
+TEST(ContainerQueryLibrary, AssociativeContainers) {
+	std::map<int, std::string> names{ {1, "a"}, {2, "bb"}, {3, "ccc"}, {4, "dd"} };
+	std::map<int, std::string> longNames = cql::Where(names, [](const std::pair<const int, std::string>& p) { return p.second.size() > 1; });
+	EXPECT_EQ(longNames.size(), 3);
+
+	cql::Update(names, [](const std::pair<const int, std::string>& p) { return p.first > 2; }, [](std::pair<const int, std::string>& p) { p.second += "!"; });
+	EXPECT_EQ(names[3], "ccc!");
+	cql::Delete(names, [](const std::pair<const int, std::string>& p) { return p.second.size() == 2; });
+	EXPECT_EQ(names.size(), 3);
+	EXPECT_EQ(names.count(2), 0);
+
+	std::unordered_map<std::string, int> counts{ {"x", 1}, {"y", 2}, {"z", 3} };
+	cql::Delete(counts, [](const std::pair<const std::string, int>& p) { return p.second % 2 == 1; });
+	EXPECT_EQ(counts.size(), 1);
+	std::unordered_map<std::string, int> filtered = cql::Where(counts, [](const std::pair<const std::string, int>&) { return true; });
+	EXPECT_EQ(filtered.at("y"), 2);
+
+	std::set<int> numbers{ 1, 2, 3, 4, 5 };
+	EXPECT_EQ(cql::Distinct(numbers), numbers);
+	std::set<int> odd = cql::Where(numbers, [](int v) { return v % 2 == 1; });
+	EXPECT_EQ(odd, (std::set<int>{ 1, 3, 5 }));
+	cql::Update(numbers, [](int v) { return v < 3; }, [](int& v) { v += 10; });
+	EXPECT_EQ(numbers, (std::set<int>{ 3, 4, 5, 11, 12 }));
+	cql::Update(numbers, [](int& v) { v *= 2; });
+	EXPECT_EQ(numbers, (std::set<int>{ 6, 8, 10, 22, 24 }));
+
+	auto groups = cql::GroupBy(numbers, [](int v) { return v > 9; });
+	EXPECT_EQ(groups[true], (std::set<int>{ 10, 22, 24 }));
+
+	std::multiset<int> repeated{ 2, 1, 2 };
+	EXPECT_EQ(cql::Distinct(repeated), (std::vector<int>{ 1, 2 }));
+}
+
+TEST(ContainerQueryLibrary, DenseKeys) {
+	struct Event { int hour; int bytes; };
+	std::vector<Event> events{ {3, 10}, {1, 5}, {3, 7}, {23, 1}, {1, 2} };
+	auto hour = [](const Event& e) { return e.hour; };
+
+	auto range = cql::DenseKeyRange<int>::Detect(events, hour);
+	ASSERT_TRUE(range.has_value());
+	EXPECT_EQ(range->min, 1);
+	EXPECT_EQ(range->size(), 23);
+	EXPECT_FALSE(cql::DenseKeyRange<int>::Detect(events, hour, 10).has_value());
+
+	auto groups = cql::GroupByDense(events, hour, cql::DenseKeyRange<int>(0, 23));
+	auto expected = cql::GroupByCompact(events, hour);
+	EXPECT_EQ(groups.Keys(), expected.Keys());
+	EXPECT_EQ(groups.Offsets(), expected.Offsets());
+	ASSERT_EQ(groups[3].size(), 2);
+	EXPECT_EQ(groups[3][1].bytes, 7);
+
+	auto sum = [](int total, const Event& e) { return total + e.bytes; };
+	EXPECT_EQ(cql::AggregateByDense(events, hour, *range, 0, sum), cql::AggregateBy(events, hour, 0, sum));
+
+	std::list<std::pair<int, char>> labels{ {1, 'a'}, {2, 'b'}, {23, 'c'}, {1, 'd'} };
+	auto label = [](const std::pair<int, char>& l) { return l.first; };
+	auto joined = cql::JoinDense(events, labels, hour, label, cql::DenseKeyRange<int>(0, 23));
+	auto reference = cql::Join(events, labels, hour, label);
+	ASSERT_EQ(joined.size(), reference.size());
+	for (auto& elem : reference)
+	{
+		EXPECT_EQ(joined[elem.first].first.size(), elem.second.first.size());
+		EXPECT_EQ(joined[elem.first].second, elem.second.second);
+	}
+
+	EXPECT_THROW(cql::GroupByDense(events, hour, cql::DenseKeyRange<int>(0, 10)), std::out_of_range);
+	cql::DenseKeyRange<int8_t> signedRange(-128, 127);
+	EXPECT_EQ(signedRange.size(), 256);
+	EXPECT_EQ(signedRange.Key(signedRange.Index(-5)), -5);
+	EXPECT_THROW(cql::DenseKeyRange<uint64_t>(0, std::numeric_limits<uint64_t>::max()), std::invalid_argument);
+	EXPECT_THROW(cql::DenseKeyRange<int>(0, 1 << 24), std::invalid_argument);
+	EXPECT_EQ(cql::DenseKeyRange<int>(0, (1 << 24) - 1).size(), size_t(1) << 24);
+	std::vector<int64_t> wide{ std::numeric_limits<int64_t>::min(), std::numeric_limits<int64_t>::max() };
+	EXPECT_FALSE(cql::DenseKeyRange<int64_t>::Detect(wide, [](int64_t v) { return v; }, size_t(-1)).has_value());
+}
+
+TEST(ContainerQueryLibrary, CountingSortAndCountBy) {
+	struct Event { int hour; int id; };
+	auto hour = [](const Event& e) { return e.hour; };
+	std::list<Event> events{ {5, 0}, {2, 1}, {5, 2}, {0, 3}, {2, 4} };
+	cql::OrderByKey(events, hour, cql::DenseKeyRange<int>(0, 23));
+	auto ids = cql::Select(events, [](const Event& e) { return e.id; });
+	EXPECT_EQ(std::vector<int>(ids.begin(), ids.end()), (std::vector<int>{ 3, 1, 4, 0, 2 }));
+
+	auto counts = cql::CountBy(events, hour);
+	EXPECT_EQ(counts.size(), 3);
+	EXPECT_EQ(counts[2], 2);
+	EXPECT_EQ(counts[0], 1);
+
+	std::vector<Event> many;
+	for (int i = 0; i < 300000; i++)
+		many.push_back({ i % 24, i });
+	auto histogram = cql::CountByDense(many, hour, cql::DenseKeyRange<int>(0, 23), 4);
+	ASSERT_EQ(histogram.size(), 24);
+	EXPECT_EQ(histogram[0], 12500);
+	EXPECT_EQ(histogram[23], 12500);
+	EXPECT_EQ(cql::CountByDense(many, hour, cql::DenseKeyRange<int>(0, 23), 1), histogram);
+	EXPECT_THROW(cql::CountByDense(many, hour, cql::DenseKeyRange<int>(0, 22), 4), std::out_of_range);
+}
+
+TEST(ContainerQueryLibrary, FlatHashMap) {
+	cql::FlatHashMap<int, int> map;
+	std::unordered_map<int, int> reference;
+	for (int i = 0; i < 5000; i++)
+	{
+		int key = (i * 7919) % 3001;
+		map[key] += i;
+		reference[key] += i;
+		if (i % 3 == 0)
+		{
+			EXPECT_EQ(map.erase(key / 2), reference.erase(key / 2));
+		}
+	}
+	ASSERT_EQ(map.size(), reference.size());
+	for (auto& elem : reference)
+		EXPECT_EQ(map.at(elem.first), elem.second);
+	size_t visited = 0;
+	for (auto& elem : map)
+	{
+		EXPECT_EQ(reference.at(elem.first), elem.second);
+		visited++;
+	}
+	EXPECT_EQ(visited, reference.size());
+	EXPECT_THROW(map.at(-1), std::out_of_range);
+
+	for (auto itr = map.begin(); itr != map.end();)
+		itr = itr->first % 2 == 0 ? map.erase(itr) : std::next(itr);
+	EXPECT_TRUE(cql::Where(map, [](const std::pair<const int, int>& p) { return p.first % 2 == 0; }).empty());
+
+	cql::FlatHashMap<std::string, std::vector<int>> strings;
+	strings["a"].push_back(1);
+	EXPECT_FALSE(strings.try_emplace("a", 3, 7).second);
+	auto copy = strings;
+	copy["b"];
+	EXPECT_EQ(strings.size(), 1);
+	EXPECT_EQ(copy.size(), 2);
+	EXPECT_EQ(copy.at("a"), std::vector<int>{ 1 });
+
+	cql::FlatHashSet<std::string> set;
+	EXPECT_TRUE(set.insert("x").second);
+	EXPECT_FALSE(set.insert("x").second);
+	EXPECT_TRUE(set.contains("x"));
+	EXPECT_TRUE(set.contains(std::string_view("x")));
+	EXPECT_EQ(set.count(std::string_view("y")), 0);
+	EXPECT_EQ(set.erase(std::string_view("x")), 1);
+	EXPECT_TRUE(set.empty());
+	set.insert("x");
+	set.clear();
+	EXPECT_TRUE(set.empty());
+
+	std::string_view view = "a";
+	EXPECT_EQ(strings.find(view), strings.begin());
+	EXPECT_EQ(strings.at(view), std::vector<int>{ 1 });
+	EXPECT_EQ(std::as_const(strings).at(view), std::vector<int>{ 1 });
+	EXPECT_THROW(strings.at(std::string_view("z")), std::out_of_range);
+	EXPECT_EQ(copy.erase(std::string_view("b")), 1);
+
+	cql::FlatHashMap<cql::HashedKey<std::string>, int> hashed;
+	hashed[cql::HashedKey<std::string>("k")] = 3;
+	EXPECT_EQ(hashed.at(cql::HashedKey<std::string_view>("k")), 3);
+	EXPECT_FALSE(hashed.contains(cql::HashedKey<std::string_view>("q")));
+}
+
+TEST(ContainerQueryLibrary, JoinIndicesAndGather) {
+	struct Order { int id; int customerId; };
+	struct Customer { int id; std::string name; };
+	std::vector<Order> orders{ {10, 1}, {11, 3}, {12, 2}, {13, 1}, {14, 9} };
+	std::list<Customer> customers{ {1, "ann"}, {2, "bob"}, {1, "ann2"}, {3, "cid"} };
+	auto orderKey = [](const Order& o) { return o.customerId; };
+	auto customerKey = [](const Customer& c) { return c.id; };
+
+	auto pairs = cql::JoinIndices(orders, customers, orderKey, customerKey);
+	std::vector<std::pair<size_t, size_t>> expected{ {0, 0}, {0, 2}, {1, 3}, {2, 1}, {3, 0}, {3, 2} };
+	EXPECT_EQ(pairs, expected);
+
+	auto rows = cql::Gather(orders, customers, pairs, [](const Order& o, const Customer& c) { return std::to_string(o.id) + c.name; });
+	EXPECT_EQ(rows, (std::vector<std::string>{ "10ann", "10ann2", "11cid", "12bob", "13ann", "13ann2" }));
+
+	auto names = cql::Gather(customers, std::vector<size_t>{ 3, 0 }, [](const Customer& c) { return c.name; });
+	EXPECT_EQ(names, (std::vector<std::string>{ "cid", "ann" }));
+
+	auto joined = cql::Join(orders, customers, orderKey, customerKey);
+	size_t joinedPairs = 0;
+	for (auto& elem : joined)
+		joinedPairs += elem.second.first.size() * elem.second.second.size();
+	EXPECT_EQ(joinedPairs, pairs.size());
+}